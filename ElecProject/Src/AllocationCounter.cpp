@@ -0,0 +1,85 @@
+#include "AllocationCounter.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+	constinit std::atomic<size_t> allocations = 0;
+	constinit thread_local size_t threadAllocations = 0;
+
+	void* allocate(std::size_t size, std::size_t alignment)
+	{
+		allocations.fetch_add(1, std::memory_order_relaxed);
+		++threadAllocations;
+		if (size == 0)
+			size = 1;
+		for (;;)
+		{
+#if defined(_MSC_VER)
+			void* p = alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__ ? _aligned_malloc(size, alignment) : std::malloc(size);
+#else
+			// aligned_alloc wants the size to be a multiple of the alignment
+			void* p = alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__ ? std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment) : std::malloc(size);
+#endif
+			if (p)
+				return p;
+			if (std::new_handler handler = std::get_new_handler())
+				handler();
+			else
+				throw std::bad_alloc();
+		}
+	}
+}
+
+namespace phys
+{
+	size_t allocationCount()
+	{
+		return allocations.load(std::memory_order_relaxed);
+	}
+
+	size_t threadAllocationCount()
+	{
+		return threadAllocations;
+	}
+}
+
+// Replacements of the global allocation functions. The array, nothrow and sized
+// versions of the standard library forward to these, so they are counted too.
+void* operator new(std::size_t size)
+{
+	return allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+	return allocate(size, (std::size_t)alignment);
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, [[maybe_unused]] std::align_val_t alignment) noexcept
+{
+#if defined(_MSC_VER)
+	if ((std::size_t)alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+	{
+		_aligned_free(p);
+		return;
+	}
+#endif
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	::operator delete(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t alignment) noexcept
+{
+	::operator delete(p, alignment);
+}
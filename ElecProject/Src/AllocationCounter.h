@@ -0,0 +1,58 @@
+//
+// Counts the calls to the global operator new of the whole program,
+// so code that is meant to run without allocating (like a physics step
+// in the steady state) can be checked.
+//
+
+#pragma once
+#include <cstddef>
+
+namespace phys
+{
+	// Number of heap allocations made by any thread since the program started
+	size_t allocationCount();
+	// Number of heap allocations made by the calling thread since it started
+	size_t threadAllocationCount();
+
+	// Counts the allocations made while it is alive
+	//	AllocationScope scope;
+	//	step();
+	//	assert(scope.allocations() == 0);
+	class AllocationScope
+	{
+	public:
+		AllocationScope()
+			:
+			start(allocationCount())
+		{
+		}
+
+		size_t allocations() const
+		{
+			return allocationCount() - start;
+		}
+
+	private:
+		size_t start;
+	};
+
+	// Same as AllocationScope, but only counts the allocations of the thread
+	// that created it, for code running next to threads that do allocate
+	class ThreadAllocationScope
+	{
+	public:
+		ThreadAllocationScope()
+			:
+			start(threadAllocationCount())
+		{
+		}
+
+		size_t allocations() const
+		{
+			return threadAllocationCount() - start;
+		}
+
+	private:
+		size_t start;
+	};
+}
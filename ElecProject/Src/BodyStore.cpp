@@ -0,0 +1,152 @@
+#include "BodyStore.h"
+#include <algorithm>
+#include <cassert>
+#include <new>
+
+namespace phys
+{
+	BodyStore::~BodyStore()
+	{
+		::operator delete(block, std::align_val_t(Alignment));
+	}
+
+	BodyId BodyStore::add(const Body& body)
+	{
+		if (count == capacity)
+			reserve(std::max<size_t>(64, capacity * 2));
+
+		BodyId id;
+		if (!freeIds.empty())
+		{
+			id = freeIds.back();
+			freeIds.pop_back();
+		}
+		else
+		{
+			id = (BodyId)indices.size();
+			indices.push_back(InvalidIndex);
+		}
+
+		const size_t index = count++;
+		indices[id] = (uint32_t)index;
+		ids.push_back(id);
+		set(index, body);
+		return id;
+	}
+
+	void BodyStore::add(const Body& body, BodyId id)
+	{
+		assert(!contains(id) && "Adding a body under an id that is in use");
+		if (count == capacity)
+			reserve(std::max<size_t>(64, capacity * 2));
+
+		// Ids skipped on the way stay unused, they aren't handed out by add(body)
+		if (id >= indices.size())
+			indices.resize((size_t)id + 1, InvalidIndex);
+		else
+			freeIds.erase(std::remove(freeIds.begin(), freeIds.end(), id), freeIds.end());
+
+		const size_t index = count++;
+		indices[id] = (uint32_t)index;
+		ids.push_back(id);
+		set(index, body);
+	}
+
+	size_t BodyStore::append(size_t n)
+	{
+		if (count + n > capacity)
+			reserve(std::max(count + n, capacity * 2));
+
+		const size_t first = count;
+		const BodyId firstId = (BodyId)indices.size();
+		indices.resize(indices.size() + n);
+		ids.resize(count + n);
+		for (size_t k = 0; k < n; ++k)
+		{
+			ids[first + k] = firstId + (BodyId)k;
+			indices[firstId + k] = (uint32_t)(first + k);
+		}
+		count += n;
+		return first;
+	}
+
+	void BodyStore::remove(BodyId id)
+	{
+		assert(contains(id) && "Removing a body that isn't in the store");
+		const size_t index = indices[id];
+		const size_t last = count - 1;
+
+		// Keep the arrays dense by moving the last body into the hole
+		if (index != last)
+		{
+			for (float* f : fields)
+				f[index] = f[last];
+			ids[index] = ids[last];
+			indices[ids[index]] = (uint32_t)index;
+		}
+
+		ids.pop_back();
+		indices[id] = InvalidIndex;
+		freeIds.push_back(id);
+		--count;
+	}
+
+	void BodyStore::reserve(size_t newCapacity)
+	{
+		// Round up so every field starts on an alignment boundary
+		constexpr size_t floatsPerLine = Alignment / sizeof(float);
+		newCapacity = (newCapacity + floatsPerLine - 1) / floatsPerLine * floatsPerLine;
+		if (newCapacity <= capacity)
+			return;
+
+		float* newBlock = static_cast<float*>(::operator new(newCapacity * FieldCount * sizeof(float), std::align_val_t(Alignment)));
+		for (size_t f = 0; f < FieldCount; ++f)
+		{
+			float* newField = newBlock + f * newCapacity;
+			if (count > 0)
+				std::copy(fields[f], fields[f] + count, newField);
+			fields[f] = newField;
+		}
+
+		::operator delete(block, std::align_val_t(Alignment));
+		block = newBlock;
+		capacity = newCapacity;
+		ids.reserve(capacity);
+	}
+
+	void BodyStore::clear()
+	{
+		count = 0;
+		ids.clear();
+		indices.clear();
+		freeIds.clear();
+	}
+
+	Body BodyStore::get(size_t index) const
+	{
+		Body b;
+		b.x = fields[X][index];
+		b.y = fields[Y][index];
+		b.z = fields[Z][index];
+		b.vx = fields[VX][index];
+		b.vy = fields[VY][index];
+		b.vz = fields[VZ][index];
+		b.mass = fields[Mass][index];
+		b.radius = fields[Radius][index];
+		b.seed = fields[Seed][index];
+		return b;
+	}
+
+	void BodyStore::set(size_t index, const Body& body)
+	{
+		fields[X][index] = body.x;
+		fields[Y][index] = body.y;
+		fields[Z][index] = body.z;
+		fields[VX][index] = body.vx;
+		fields[VY][index] = body.vy;
+		fields[VZ][index] = body.vz;
+		fields[Mass][index] = body.mass;
+		fields[Radius][index] = body.radius;
+		fields[Seed][index] = body.seed;
+	}
+}
@@ -0,0 +1,100 @@
+//
+// Structure of arrays storage for the simulation state of every body.
+// Each field lives in its own contiguous, 64 byte aligned array so the
+// physics can stream over them. Bodies are referred to by a stable id,
+// their index in the arrays changes when other bodies are removed.
+//
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace phys
+{
+	using BodyId = uint32_t;
+
+	// Description of a single body, used to add and read back bodies
+	struct Body
+	{
+		float x = 0, y = 0, z = 0;
+		float vx = 0, vy = 0, vz = 0;
+		float mass = 1.f;
+		float radius = 1.f;
+		float seed = 0.f; // terrain of the planet drawn for it, the physics doesn't use it
+	};
+
+	class BodyStore
+	{
+	public:
+		static constexpr size_t Alignment = 64;
+		static constexpr uint32_t InvalidIndex = UINT32_MAX;
+
+		BodyStore() = default;
+		~BodyStore();
+		BodyStore(const BodyStore&) = delete;
+		BodyStore& operator=(const BodyStore&) = delete;
+
+		// Adds a body at the end of the arrays and returns its id
+		BodyId add(const Body& body);
+		// Adds a body under an id the caller handed out itself, the id must not be in use
+		void add(const Body& body, BodyId id);
+		// Adds n bodies at the end under new ids (freed ids aren't reused) and returns the
+		// index of the first. Their fields are left for the caller to fill in.
+		size_t append(size_t n);
+		// Removes a body, the last body is moved into its slot
+		void remove(BodyId id);
+		void reserve(size_t newCapacity);
+		void clear();
+
+		size_t size() const { return count; }
+		bool empty() const { return count == 0; }
+		size_t indexOf(BodyId id) const { return indices[id]; }
+		BodyId idAt(size_t index) const { return ids[index]; }
+		bool contains(BodyId id) const { return id < indices.size() && indices[id] != InvalidIndex; }
+		Body get(size_t index) const;
+		void set(size_t index, const Body& body);
+
+		// Field arrays, valid for [0, size()) until the next add/remove/reserve
+		float* x() { return fields[X]; }
+		float* y() { return fields[Y]; }
+		float* z() { return fields[Z]; }
+		float* vx() { return fields[VX]; }
+		float* vy() { return fields[VY]; }
+		float* vz() { return fields[VZ]; }
+		float* mass() { return fields[Mass]; }
+		float* radius() { return fields[Radius]; }
+		float* seed() { return fields[Seed]; }
+		const float* x() const { return fields[X]; }
+		const float* y() const { return fields[Y]; }
+		const float* z() const { return fields[Z]; }
+		const float* vx() const { return fields[VX]; }
+		const float* vy() const { return fields[VY]; }
+		const float* vz() const { return fields[VZ]; }
+		const float* mass() const { return fields[Mass]; }
+		const float* radius() const { return fields[Radius]; }
+		const float* seed() const { return fields[Seed]; }
+
+	private:
+		enum Field
+		{
+			X, Y, Z,
+			VX, VY, VZ,
+			Mass,
+			Radius,
+			Seed,
+			FieldCount
+		};
+
+	private:
+		// One allocation holds every field, each one capacity floats long
+		float* block = nullptr;
+		float* fields[FieldCount] = {};
+		size_t count = 0;
+		size_t capacity = 0;
+
+		std::vector<BodyId> ids; // index -> id
+		std::vector<uint32_t> indices; // id -> index
+		std::vector<BodyId> freeIds;
+	};
+}
@@ -0,0 +1,78 @@
+//
+// Boundaries that act on the state after a step instead of through a
+// force. Reflective walls mirror a body that crossed them back inside
+// and turn its velocity around; a periodic box wraps it to the opposite
+// side. Each is one pass over the position and velocity arrays, written
+// with selects instead of branches so the loops vectorize. The soft
+// bounding sphere (a spring with a damper) is a force term instead, it
+// is fused into the force pass as BoundingSphere of ForceTerms.h.
+// Gravity and collisions don't see through the sides of a periodic box.
+//
+
+#pragma once
+#include "PhysEngine.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+
+namespace phys
+{
+	// Walls at +-halfSize on every axis, restitution 1 keeps the speed
+	struct ReflectiveBox
+	{
+		float halfSize;
+		float restitution = 1.f;
+
+		template<typename Real>
+		void apply(Real* const pos[3], Real* const vel[3], size_t begin, size_t end) const
+		{
+			const Real h = halfSize;
+			const Real e = restitution;
+			for (int c = 0; c < 3; ++c)
+			{
+				Real* p = pos[c];
+				Real* v = vel[c];
+				for (size_t i = begin; i < end; ++i)
+				{
+					const Real above = p[i] - h;
+					const Real below = -h - p[i];
+					// Mirrored at the wall it crossed, clamped in case it crossed the whole box
+					const Real mirrored = p[i] - 2 * std::max(above, Real(0)) + 2 * std::max(below, Real(0));
+					p[i] = std::clamp(mirrored, -h, h);
+					// Only bodies moving further out bounce, the others are on their way back already
+					const bool bounce = ((above > 0) & (v[i] > 0)) | ((below > 0) & (v[i] < 0));
+					v[i] = bounce ? -e * v[i] : v[i];
+				}
+			}
+		}
+	};
+
+	// Box of side 2 * halfSize around the origin whose opposite sides are joined
+	struct PeriodicBox
+	{
+		float halfSize;
+
+		template<typename Real>
+		void apply(Real* const pos[3], Real* const[3], size_t begin, size_t end) const
+		{
+			const Real h = halfSize;
+			const Real size = 2 * h;
+			for (int c = 0; c < 3; ++c)
+			{
+				Real* p = pos[c];
+				for (size_t i = begin; i < end; ++i)
+					p[i] -= size * std::floor((p[i] + h) / size);
+			}
+		}
+	};
+
+	// Applies a boundary to every body, split across the thread pool
+	template<typename Boundary, typename Real>
+	void applyBoundary(const Boundary& boundary, Real* const pos[3], Real* const vel[3], size_t n)
+	{
+		parallelFor(n, integrateGrain, [&](size_t begin, size_t end)
+			{
+				boundary.apply(pos, vel, begin, end);
+			});
+	}
+}
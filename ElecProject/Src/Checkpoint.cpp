@@ -0,0 +1,271 @@
+#include "Checkpoint.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <fstream>
+
+#if defined(_WIN32)
+#include "Win.h"
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	using namespace phys;
+
+	// The arrays are written as they are in memory
+	static_assert(std::endian::native == std::endian::little, "Checkpoints are little-endian");
+
+	constexpr size_t fieldCount = (size_t)CheckpointField::Count;
+	constexpr size_t floatsPerLine = 64 / sizeof(float);
+	// Floats per copy task when loading
+	constexpr size_t loadGrain = 1 << 16;
+
+	size_t fieldStrideFor(size_t bodyCount)
+	{
+		return (bodyCount + floatsPerLine - 1) / floatsPerLine * floatsPerLine;
+	}
+}
+
+namespace phys
+{
+	bool isCheckpointFile(const std::string& path)
+	{
+		char magic[sizeof(CheckpointHeader::Magic)] = {};
+		std::ifstream file(path, std::ios::binary);
+		file.read(magic, sizeof(magic));
+		return file && std::memcmp(magic, CheckpointHeader::Magic, sizeof(magic)) == 0;
+	}
+
+	bool writeCheckpoint(const std::string& path, const CheckpointData& data, std::string& error)
+	{
+		CheckpointHeader header = {};
+		std::memcpy(header.magic, CheckpointHeader::Magic, sizeof(header.magic));
+		header.version = CheckpointHeader::Version;
+		header.byteOrder = CheckpointHeader::ByteOrderMark;
+		header.bodyCount = data.bodyCount;
+		header.fieldStride = fieldStrideFor(data.bodyCount);
+		header.simulatedTime = data.simulatedTime;
+		header.G = data.G;
+		header.boundarySize = data.boundarySize;
+		header.boundary = (uint32_t)data.boundary;
+		header.fieldCount = (uint32_t)fieldCount;
+
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		if (!file)
+		{
+			error = "Can't open " + path + " for writing";
+			return false;
+		}
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		// Each array is padded up to the stride so the next one starts on a cache line
+		const float padding[floatsPerLine] = {};
+		const size_t paddingCount = (size_t)header.fieldStride - data.bodyCount;
+		for (size_t f = 0; f < fieldCount; ++f)
+		{
+			file.write(reinterpret_cast<const char*>(data.fields[f]), data.bodyCount * sizeof(float));
+			file.write(reinterpret_cast<const char*>(padding), paddingCount * sizeof(float));
+		}
+		file.close();
+		if (!file)
+		{
+			error = "Writing " + path + " failed";
+			return false;
+		}
+		return true;
+	}
+
+	CheckpointFile::~CheckpointFile()
+	{
+		close();
+	}
+
+	bool CheckpointFile::open(const std::string& path, std::string& error)
+	{
+		close();
+		const void* view = nullptr;
+		size_t fileSize = 0;
+#if defined(_WIN32)
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			error = "Can't open " + path;
+			return false;
+		}
+		LARGE_INTEGER length;
+		if (GetFileSizeEx(file, &length))
+			fileSize = (size_t)length.QuadPart;
+		HANDLE map = fileSize > 0 ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+		// The mapping keeps the file open
+		CloseHandle(file);
+		if (map)
+		{
+			view = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+			if (view)
+				mapping = map;
+			else
+				CloseHandle(map);
+		}
+#else
+		const int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			error = "Can't open " + path;
+			return false;
+		}
+		struct stat info;
+		if (fstat(fd, &info) == 0)
+			fileSize = (size_t)info.st_size;
+		if (fileSize > 0)
+		{
+			void* v = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (v != MAP_FAILED)
+				view = v;
+		}
+		// The mapping keeps the file open
+		::close(fd);
+#endif
+		if (!view)
+		{
+			error = "Can't map " + path;
+			return false;
+		}
+		header = static_cast<const CheckpointHeader*>(view);
+		mappedSize = fileSize;
+
+		// Everything the accessors rely on
+		if (fileSize < sizeof(CheckpointHeader) || std::memcmp(header->magic, CheckpointHeader::Magic, sizeof(header->magic)) != 0)
+			error = path + " isn't a checkpoint";
+		else if (header->byteOrder != CheckpointHeader::ByteOrderMark)
+			error = path + " has the wrong byte order";
+		else if (header->version != CheckpointHeader::Version)
+			error = path + " is version " + std::to_string(header->version) + ", this reads version " + std::to_string(CheckpointHeader::Version);
+		else if (header->bodyCount >= BodyStore::InvalidIndex)
+			error = path + " has more bodies than the store has ids";
+		else if (header->fieldCount < fieldCount || header->fieldStride < header->bodyCount || header->fieldStride % floatsPerLine != 0 ||
+			(fileSize - sizeof(CheckpointHeader)) / sizeof(float) / header->fieldCount < header->fieldStride ||
+			header->boundary > (uint32_t)Simulation::Boundary::None)
+			error = path + " is cut off or damaged";
+		else
+			return true;
+		close();
+		return false;
+	}
+
+	void CheckpointFile::close()
+	{
+		if (!header)
+			return;
+#if defined(_WIN32)
+		UnmapViewOfFile(header);
+		CloseHandle(mapping);
+#else
+		munmap(const_cast<CheckpointHeader*>(header), mappedSize);
+#endif
+		header = nullptr;
+		mapping = nullptr;
+		mappedSize = 0;
+	}
+
+	const float* CheckpointFile::field(CheckpointField f) const
+	{
+		const float* first = reinterpret_cast<const float*>(header + 1);
+		return first + (size_t)f * header->fieldStride;
+	}
+
+	Body CheckpointFile::getBody(size_t index) const
+	{
+		Body b;
+		b.x = field(CheckpointField::X)[index];
+		b.y = field(CheckpointField::Y)[index];
+		b.z = field(CheckpointField::Z)[index];
+		b.vx = field(CheckpointField::VX)[index];
+		b.vy = field(CheckpointField::VY)[index];
+		b.vz = field(CheckpointField::VZ)[index];
+		b.mass = field(CheckpointField::Mass)[index];
+		b.radius = field(CheckpointField::Radius)[index];
+		b.seed = field(CheckpointField::Seed)[index];
+		return b;
+	}
+
+	void CheckpointFile::loadInto(BodyStore& bodies) const
+	{
+		const size_t n = size();
+		bodies.clear();
+		bodies.append(n);
+		float* const to[fieldCount] = {
+			bodies.x(), bodies.y(), bodies.z(),
+			bodies.vx(), bodies.vy(), bodies.vz(),
+			bodies.mass(), bodies.radius(), bodies.seed()
+		};
+		// Straight copies, split so that the page faults of the mapping are spread over the threads as well
+		const size_t chunks = (n + loadGrain - 1) / loadGrain;
+		parallelFor(fieldCount * chunks, 1, [&](size_t begin, size_t end)
+			{
+				for (size_t k = begin; k < end; ++k)
+				{
+					const size_t f = k / chunks;
+					const size_t first = (k % chunks) * loadGrain;
+					const size_t count = std::min(loadGrain, n - first);
+					std::memcpy(to[f] + first, field((CheckpointField)f) + first, count * sizeof(float));
+				}
+			});
+	}
+
+	CheckpointWriter::~CheckpointWriter()
+	{
+		if (thread.joinable())
+			thread.join();
+	}
+
+	bool CheckpointWriter::save(const std::string& newPath, const Snapshot& snapshot, const Simulation::Settings& settings)
+	{
+		if (isSaving())
+			return false;
+		if (thread.joinable())
+			thread.join();
+
+		// The snapshot is only valid until the next one is taken, the bodies are copied out right away
+		const size_t n = snapshot.bodies.size();
+		fields.resize(fieldCount * n);
+		float* to[fieldCount];
+		for (size_t f = 0; f < fieldCount; ++f)
+			to[f] = fields.data() + f * n;
+		for (size_t i = 0; i < n; ++i)
+		{
+			const Body& b = snapshot.bodies[i];
+			to[0][i] = b.x; to[1][i] = b.y; to[2][i] = b.z;
+			to[3][i] = b.vx; to[4][i] = b.vy; to[5][i] = b.vz;
+			to[6][i] = b.mass;
+			to[7][i] = b.radius;
+			to[8][i] = b.seed;
+		}
+		data.bodyCount = n;
+		for (size_t f = 0; f < fieldCount; ++f)
+			data.fields[f] = to[f];
+		data.simulatedTime = snapshot.simulatedTime;
+		data.G = settings.G;
+		data.boundarySize = settings.boundarySize;
+		data.boundary = settings.boundary;
+		path = newPath;
+
+		saving.store(true, std::memory_order_release);
+		thread = std::thread([this]()
+			{
+				std::string error;
+				status = writeCheckpoint(path, data, error) ? "Saved " + std::to_string(data.bodyCount) + " bodies to " + path : error;
+				saving.store(false, std::memory_order_release);
+			});
+		return true;
+	}
+
+	std::string CheckpointWriter::getStatus() const
+	{
+		return isSaving() ? std::string() : status;
+	}
+}
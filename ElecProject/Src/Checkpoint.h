@@ -0,0 +1,135 @@
+//
+// Binary checkpoints of the whole simulation to restart it later.
+// The file is a 64 byte header followed by one array per body field
+// (x, y, z, vx, vy, vz, mass, radius, seed), each 64 byte aligned, in
+// little-endian byte order. That is the layout of the body store, so a
+// checkpoint is read by mapping the file into memory: opening one only
+// checks the header, and loading copies the arrays into the store in
+// chunks split over the threads as the os pages them in. The simulation
+// works on that copy, the mapping is only read (the game also copies each
+// body into a planet). Saving copies the bodies of a snapshot and
+// writes them on a thread of its own, neither the frame nor the physics
+// wait for the disk.
+//
+
+#pragma once
+#include "BodyStore.h"
+#include "SimulationThread.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace phys
+{
+	// Start of a checkpoint file, followed by the field arrays
+	struct CheckpointHeader
+	{
+		static constexpr char Magic[8] = { 'E', 'L', 'E', 'C', 'C', 'K', 'P', 'T' };
+		static constexpr uint32_t Version = 1;
+		static constexpr uint32_t ByteOrderMark = 0x01020304; // reads back swapped on a big-endian machine
+
+		char magic[8];
+		uint32_t version;
+		uint32_t byteOrder;
+		uint64_t bodyCount;
+		uint64_t fieldStride; // floats from the start of one field array to the next, a multiple of 16
+		double simulatedTime;
+		float G;
+		float boundarySize;
+		uint32_t boundary; // Simulation::Boundary
+		uint32_t fieldCount;
+		uint8_t reserved[8];
+	};
+	static_assert(sizeof(CheckpointHeader) == 64, "The header is part of the file format");
+
+	// Body fields in the order of their arrays in the file
+	enum class CheckpointField : uint32_t
+	{
+		X, Y, Z,
+		VX, VY, VZ,
+		Mass,
+		Radius,
+		Seed,
+		Count
+	};
+
+	// Bodies and parameters to write, the fields are arrays of bodyCount floats
+	struct CheckpointData
+	{
+		size_t bodyCount = 0;
+		const float* fields[(size_t)CheckpointField::Count] = {};
+		double simulatedTime = 0;
+		float G = 1.f;
+		float boundarySize = 0;
+		Simulation::Boundary boundary = Simulation::Boundary::Sphere;
+	};
+
+	// Whether the file starts like a checkpoint, to tell them from other inputs
+	bool isCheckpointFile(const std::string& path);
+
+	// Writes a checkpoint, returns false with the reason in error when it can't
+	bool writeCheckpoint(const std::string& path, const CheckpointData& data, std::string& error);
+
+	// Read only view of a checkpoint file mapped into memory
+	class CheckpointFile
+	{
+	public:
+		CheckpointFile() = default;
+		~CheckpointFile();
+		CheckpointFile(const CheckpointFile&) = delete;
+		CheckpointFile& operator=(const CheckpointFile&) = delete;
+
+		// Maps the file and checks its header, returns false with the reason in error when
+		// it isn't a checkpoint this version can read
+		bool open(const std::string& path, std::string& error);
+		void close();
+		bool isOpen() const { return header != nullptr; }
+
+		size_t size() const { return (size_t)header->bodyCount; }
+		double getSimulatedTime() const { return header->simulatedTime; }
+		float getG() const { return header->G; }
+		float getBoundarySize() const { return header->boundarySize; }
+		Simulation::Boundary getBoundary() const { return (Simulation::Boundary)header->boundary; }
+
+		// Field arrays of size() floats, pointing into the mapping
+		const float* field(CheckpointField f) const;
+		Body getBody(size_t index) const;
+
+		// Replaces the bodies of the store with the ones in the file, ids 0..size()-1
+		void loadInto(BodyStore& bodies) const;
+
+	private:
+		const CheckpointHeader* header = nullptr;
+		size_t mappedSize = 0;
+		void* mapping = nullptr; // file mapping handle, only used on windows
+	};
+
+	// Saves snapshots on a thread of its own, one at a time
+	class CheckpointWriter
+	{
+	public:
+		CheckpointWriter() = default;
+		~CheckpointWriter();
+		CheckpointWriter(const CheckpointWriter&) = delete;
+		CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+		// Copies the bodies of the snapshot and starts writing them, returns false
+		// when the last checkpoint is still being written
+		bool save(const std::string& path, const Snapshot& snapshot, const Simulation::Settings& settings);
+		bool isSaving() const { return saving.load(std::memory_order_acquire); }
+		// Outcome of the last save that finished, empty while none did
+		std::string getStatus() const;
+
+	private:
+		std::thread thread;
+		std::atomic<bool> saving = false;
+		// Owned by the writing thread while saving
+		std::vector<float> fields; // the field arrays one after the other
+		CheckpointData data;
+		std::string path;
+		std::string status;
+	};
+}
@@ -0,0 +1,245 @@
+#include "Collisions.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <numeric>
+
+namespace phys
+{
+	size_t CollisionMerger::mergeTouching(BodyStore& bodies)
+	{
+		stats = {};
+		const size_t n = bodies.size();
+		if (n < 2)
+			return 0;
+		const float* const pos[3] = { bodies.x(), bodies.y(), bodies.z() };
+		const float* radius = bodies.radius();
+
+		// Sweep along the axis the bodies are spread out most on, the fewest intervals overlap there
+		int axis = 0;
+		float widest = -1.f;
+		for (int c = 0; c < 3; ++c)
+		{
+			const auto [lo, hi] = std::minmax_element(pos[c], pos[c] + n);
+			if (*hi - *lo > widest)
+			{
+				widest = *hi - *lo;
+				axis = c;
+			}
+		}
+		const float* p = pos[axis];
+		order.resize(n);
+		starts.resize(n);
+		for (size_t i = 0; i < n; ++i)
+			starts[i] = p[i] - radius[i];
+		std::iota(order.begin(), order.end(), 0u);
+		std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return starts[a] < starts[b]; });
+
+		parent.resize(n);
+		std::iota(parent.begin(), parent.end(), 0u);
+		for (size_t s = 0; s < n; ++s)
+		{
+			const uint32_t i = order[s];
+			const float end = p[i] + radius[i];
+			// Every later body that starts before i ends overlaps it along the axis
+			for (size_t t = s + 1; t < n && starts[order[t]] <= end; ++t)
+			{
+				const uint32_t j = order[t];
+				++stats.candidatePairs;
+				const float dx = pos[0][j] - pos[0][i];
+				const float dy = pos[1][j] - pos[1][i];
+				const float dz = pos[2][j] - pos[2][i];
+				const float reach = radius[i] + radius[j];
+				if (dx * dx + dy * dy + dz * dz < reach * reach)
+				{
+					++stats.contacts;
+					const uint32_t a = findRoot(i);
+					const uint32_t b = findRoot(j);
+					if (a != b)
+						parent[a] = b;
+				}
+			}
+		}
+		if (stats.contacts == 0)
+			return 0;
+
+		groups.assign(n, Group{});
+		const float* const vel[3] = { bodies.vx(), bodies.vy(), bodies.vz() };
+		const float* mass = bodies.mass();
+		for (uint32_t i = 0; i < n; ++i)
+		{
+			Group& g = groups[findRoot(i)];
+			if (g.size == 0 || mass[i] > mass[g.heaviest])
+				g.heaviest = i;
+			++g.size;
+			g.mass += mass[i];
+			for (int c = 0; c < 3; ++c)
+			{
+				g.momentum[c] += (double)mass[i] * vel[c][i];
+				g.moment[c] += (double)mass[i] * pos[c][i];
+			}
+			g.volume += (double)radius[i] * radius[i] * radius[i];
+		}
+
+		// The heaviest body of a group becomes the merged body, the others go
+		removed.clear();
+		for (uint32_t i = 0; i < n; ++i)
+		{
+			const Group& g = groups[findRoot(i)];
+			if (g.size < 2)
+				continue;
+			if (i != g.heaviest)
+			{
+				removed.push_back(bodies.idAt(i));
+				continue;
+			}
+			// The heaviest body keeps its look
+			Body merged = bodies.get(i);
+			merged.mass = (float)g.mass;
+			merged.x = (float)(g.moment[0] / g.mass);
+			merged.y = (float)(g.moment[1] / g.mass);
+			merged.z = (float)(g.moment[2] / g.mass);
+			merged.vx = (float)(g.momentum[0] / g.mass);
+			merged.vy = (float)(g.momentum[1] / g.mass);
+			merged.vz = (float)(g.momentum[2] / g.mass);
+			merged.radius = (float)std::cbrt(g.volume);
+			bodies.set(i, merged);
+		}
+		for (const BodyId id : removed)
+			bodies.remove(id);
+		stats.merged = removed.size();
+		return removed.size();
+	}
+
+	uint32_t CollisionMerger::findRoot(uint32_t i)
+	{
+		// Path halving keeps the trees flat
+		while (parent[i] != i)
+		{
+			parent[i] = parent[parent[i]];
+			i = parent[i];
+		}
+		return i;
+	}
+
+	void ElasticCollisions::resolve(BodyStore& bodies, float restitution)
+	{
+		stats = {};
+		const size_t n = bodies.size();
+		if (n < 2)
+			return;
+		float* const pos[3] = { bodies.x(), bodies.y(), bodies.z() };
+		float* const vel[3] = { bodies.vx(), bodies.vy(), bodies.vz() };
+		const float* mass = bodies.mass();
+		const float* radius = bodies.radius();
+
+		// Two bodies of at most largeRadius touch only in neighboring cells. It is the radius
+		// all but maxLargeBodies bodies fit in, the bigger ones look at every body instead
+		radii.assign(radius, radius + n);
+		const size_t typical = n > maxLargeBodies ? n - 1 - maxLargeBodies : n - 1;
+		std::nth_element(radii.begin(), radii.begin() + typical, radii.end());
+		const float largeRadius = radii[typical];
+		const float cellSize = 2.f * largeRadius;
+		if (!(cellSize > 0))
+			return;
+		largeBodies.clear();
+		for (uint32_t i = 0; i < n; ++i)
+		{
+			if (radius[i] > largeRadius)
+				largeBodies.push_back(i);
+		}
+		deltas.resize(6 * n);
+		float* const dv[3] = { deltas.data(), deltas.data() + n, deltas.data() + 2 * n };
+		float* const dp[3] = { deltas.data() + 3 * n, deltas.data() + 4 * n, deltas.data() + 5 * n };
+
+		for (int pass = 0; pass < maxPasses; ++pass)
+		{
+			// The push apart moves the bodies, the grid is rebuilt from where they are now
+			hash.build(pos[0], pos[1], pos[2], n, cellSize);
+			const std::vector<uint32_t>& cells = hash.occupiedBuckets();
+			std::atomic<size_t> candidates = 0;
+			std::atomic<size_t> contacts = 0;
+			parallelFor(cells.size(), cellGrain, [&](size_t begin, size_t end)
+				{
+					size_t taskCandidates = 0, taskContacts = 0;
+					for (size_t k = begin; k < end; ++k)
+					{
+						hash.forEachInBucket(cells[k], [&](uint32_t i)
+							{
+								float v[3] = {}, p[3] = {};
+								const float inverseMass = 1.f / mass[i];
+								auto touch = [&](uint32_t j)
+									{
+										if (j == i)
+											return;
+										++taskCandidates;
+										const float d[3] = { pos[0][j] - pos[0][i], pos[1][j] - pos[1][i], pos[2][j] - pos[2][i] };
+										const float distSq = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+										const float reach = radius[i] + radius[j];
+										if (distSq >= reach * reach || distSq <= 0.f)
+											return;
+										++taskContacts;
+										const float dist = std::sqrt(distSq);
+										const float normal[3] = { d[0] / dist, d[1] / dist, d[2] / dist };
+										// Share of i in the response, the lighter body moves more
+										const float share = inverseMass / (inverseMass + 1.f / mass[j]);
+										// Speed of j away from i, negative while they approach
+										const float approach = (vel[0][j] - vel[0][i]) * normal[0]
+											+ (vel[1][j] - vel[1][i]) * normal[1]
+											+ (vel[2][j] - vel[2][i]) * normal[2];
+										const float bounce = approach < 0.f ? (1.f + restitution) * approach * share : 0.f;
+										const float push = separation * (reach - dist) * share;
+										for (int c = 0; c < 3; ++c)
+										{
+											v[c] += bounce * normal[c];
+											p[c] -= push * normal[c];
+										}
+									};
+								// A large body reaches past the cells around it, a pair with one is found
+								// through the list from the small side so it isn't seen twice
+								if (radius[i] > largeRadius)
+								{
+									for (uint32_t j = 0; j < n; ++j)
+										touch(j);
+								}
+								else
+								{
+									hash.forEachNear(pos[0][i], pos[1][i], pos[2][i], [&](uint32_t j)
+										{
+											if (radius[j] <= largeRadius)
+												touch(j);
+										});
+									for (const uint32_t j : largeBodies)
+										touch(j);
+								}
+								for (int c = 0; c < 3; ++c)
+								{
+									dv[c][i] = v[c];
+									dp[c][i] = p[c];
+								}
+							});
+					}
+					candidates += taskCandidates;
+					contacts += taskContacts;
+				});
+
+			// Every pair was seen from both of its bodies
+			if (pass == 0)
+			{
+				stats.candidatePairs = candidates / 2;
+				stats.contacts = contacts / 2;
+			}
+			if (contacts == 0)
+				break;
+			for (int c = 0; c < 3; ++c)
+			{
+				for (size_t i = 0; i < n; ++i)
+				{
+					vel[c][i] += dv[c][i];
+					pos[c][i] += dp[c][i];
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,97 @@
+//
+// Contacts between the bodies, which are spheres of their radius.
+// The broadphase sorts the bodies by where they start along the axis
+// the bodies are spread out most on and sweeps over them (sweep and
+// prune), only bodies whose intervals overlap on that axis are tested.
+// Touching bodies merge inelastically: a group of bodies that touch
+// each other becomes one body with their total mass, momentum and
+// volume at their center of mass. The merged bodies are removed from
+// the store, so the body count drops as a cluster collapses.
+// Or they bounce: the elastic response finds the contacts through a
+// spatial hash in O(n) expected time and works on all cells in parallel.
+// The cells fit all but the few biggest bodies, those are tested against
+// every body so a single giant doesn't fill each cell with thousands.
+//
+
+#pragma once
+#include "BodyStore.h"
+#include "SpatialHash.h"
+#include <cstdint>
+#include <vector>
+
+namespace phys
+{
+	struct CollisionStats
+	{
+		size_t candidatePairs = 0; // pairs the broadphase found close enough to test
+		size_t contacts = 0; // pairs of touching spheres
+		size_t merged = 0; // bodies merged into another one and removed
+	};
+
+	class CollisionMerger
+	{
+	public:
+		using Stats = CollisionStats;
+
+	public:
+		// Merges every group of touching bodies into the heaviest body of the group,
+		// which keeps its id. Returns the number of bodies removed.
+		size_t mergeTouching(BodyStore& bodies);
+		// Counters of the last mergeTouching
+		const Stats& getStats() const { return stats; }
+
+	private:
+		// Totals of a group of touching bodies, summed in double and kept by the group's root
+		struct Group
+		{
+			double mass = 0;
+			double momentum[3] = {};
+			double moment[3] = {}; // mass weighted position
+			double volume = 0; // sum of the radii cubed
+			uint32_t heaviest = 0;
+			uint32_t size = 0;
+		};
+
+	private:
+		uint32_t findRoot(uint32_t i);
+
+	private:
+		Stats stats;
+		// Kept between calls so the steady state doesn't allocate
+		std::vector<uint32_t> order; // bodies sorted by the start of their interval
+		std::vector<float> starts;
+		std::vector<uint32_t> parent; // union-find forest of the touching groups
+		std::vector<Group> groups;
+		std::vector<BodyId> removed;
+	};
+
+	// Bounces touching bodies off each other with an impulse along the line between
+	// their centers. A restitution of 1 keeps the kinetic energy, 0 takes away all the
+	// speed along that line. Each pass every body sums the impulses and the push out
+	// of the overlaps from all its contacts at once (Jacobi), so the cells can be
+	// worked on in parallel: a body only ever writes its own changes. A pair works
+	// out the same impulse from both sides, so momentum is kept.
+	class ElasticCollisions
+	{
+	public:
+		using Stats = CollisionStats;
+
+	public:
+		void resolve(BodyStore& bodies, float restitution);
+		// Counters of the first pass of the last resolve
+		const Stats& getStats() const { return stats; }
+
+	private:
+		static constexpr int maxPasses = 4; // passes over the contacts, fewer when nothing touches anymore
+		static constexpr size_t cellGrain = 64; // occupied cells per task
+		static constexpr float separation = 0.5f; // part of the overlap pushed apart each pass
+		static constexpr size_t maxLargeBodies = 64; // bodies too big for the cells, tested against all the others
+
+	private:
+		Stats stats;
+		SpatialHash hash;
+		std::vector<float> deltas; // velocity and position change of every body, 6 blocks of n
+		std::vector<float> radii; // scratch for picking the cell size
+		std::vector<uint32_t> largeBodies;
+	};
+}
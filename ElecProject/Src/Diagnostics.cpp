@@ -0,0 +1,186 @@
+#include "Diagnostics.h"
+#include "GravityKernels.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace phys
+{
+	const Diagnostics& DiagnosticsMeter::measure(const BodyStore& bodies, float G, bool exactPotential)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		diagnostics = {};
+		const size_t n = bodies.size();
+		const float* const pos[3] = { bodies.x(), bodies.y(), bodies.z() };
+		const float* const vel[3] = { bodies.vx(), bodies.vy(), bodies.vz() };
+		const float* mass = bodies.mass();
+
+		// Systematic sample by mass, see the header
+		double totalMass = 0;
+		for (size_t i = 0; i < n; ++i)
+			totalMass += mass[i];
+		const size_t target = exactPotential ? n :
+			std::min(n, std::max(minPotentialSamples, std::min(n / potentialSampleDivisor, potentialPairBudget / std::max<size_t>(n, 1))));
+		samples.clear();
+		if (target == n)
+		{
+			for (size_t i = 0; i < n; ++i)
+				samples.push_back({ i, 1.0, 0.0 });
+		}
+		else if (totalMass > 0)
+		{
+			// Bodies at least a step heavy are always taken, the rest of the samples are spread
+			// over the others. Taking them out makes the step smaller, repeated until no more are
+			double step = totalMass / target;
+			size_t heavyCount = 0;
+			for (;;)
+			{
+				size_t count = 0;
+				double heavyMass = 0;
+				for (size_t i = 0; i < n; ++i)
+				{
+					if (mass[i] >= step)
+					{
+						++count;
+						heavyMass += mass[i];
+					}
+				}
+				if (count == heavyCount || count >= target)
+					break;
+				heavyCount = count;
+				step = (totalMass - heavyMass) / (target - count);
+			}
+			// Starting half a step in keeps the first light bodies from always being taken
+			double next = 0.5 * step;
+			double accumulated = 0;
+			for (size_t i = 0; i < n; ++i)
+			{
+				if (mass[i] >= step)
+				{
+					samples.push_back({ i, 1.0, 0.0 });
+					continue;
+				}
+				accumulated += mass[i];
+				if (accumulated <= next)
+					continue;
+				samples.push_back({ i, step / mass[i], 0.0 });
+				next += std::ceil((accumulated - next) / step) * step;
+			}
+		}
+		diagnostics.potentialExact = samples.size() == n;
+		diagnostics.potentialSamples = samples.size();
+
+		const size_t blocks = (n + blockSize - 1) / blockSize;
+		partials.assign(blocks, Partial{});
+		parallelFor(blocks, 1, [&](size_t blockBegin, size_t blockEnd)
+			{
+				for (size_t b = blockBegin; b < blockEnd; ++b)
+				{
+					// An accumulator per lane, the compiler may not reorder one sum into vector lanes itself
+					double lane[sumCount][sumLanes] = {};
+					auto add = [&](size_t i, size_t l)
+						{
+							const double m = mass[i];
+							const double x = pos[0][i], y = pos[1][i], z = pos[2][i];
+							const double vx = vel[0][i], vy = vel[1][i], vz = vel[2][i];
+							const double px = m * vx, py = m * vy, pz = m * vz;
+							lane[0][l] += m;
+							lane[1][l] += m * x; lane[2][l] += m * y; lane[3][l] += m * z;
+							lane[4][l] += px; lane[5][l] += py; lane[6][l] += pz;
+							lane[7][l] += y * pz - z * py;
+							lane[8][l] += z * px - x * pz;
+							lane[9][l] += x * py - y * px;
+							lane[10][l] += 0.5 * (px * vx + py * vy + pz * vz);
+						};
+					const size_t begin = b * blockSize;
+					const size_t end = std::min(n, begin + blockSize);
+					size_t i = begin;
+					for (; i + sumLanes <= end; i += sumLanes)
+					{
+						for (size_t l = 0; l < sumLanes; ++l)
+							add(i + l, l);
+					}
+					for (; i < end; ++i)
+						add(i, 0);
+
+					double total[sumCount] = {};
+					for (size_t q = 0; q < sumCount; ++q)
+					{
+						for (size_t l = 0; l < sumLanes; ++l)
+							total[q] += lane[q][l];
+					}
+					Partial& sum = partials[b];
+					sum.mass = total[0];
+					for (int c = 0; c < 3; ++c)
+					{
+						sum.moment[c] = total[1 + c];
+						sum.momentum[c] = total[4 + c];
+						sum.angularMomentum[c] = total[7 + c];
+					}
+					sum.kineticEnergy = total[10];
+				}
+			});
+
+		// phi_i = sum over j of m_j / r_ij, with the same cutoff as the force kernels
+		parallelFor(samples.size(), 1, [&](size_t sampleBegin, size_t sampleEnd)
+			{
+				for (size_t s = sampleBegin; s < sampleEnd; ++s)
+				{
+					const size_t i = samples[s].index;
+					const float xi = pos[0][i], yi = pos[1][i], zi = pos[2][i];
+					// A sum per lane, so the loop vectorizes without reordering the additions
+					float phi[potentialLanes] = {};
+					auto add = [&](size_t j, size_t l)
+						{
+							const float dx = pos[0][j] - xi;
+							const float dy = pos[1][j] - yi;
+							const float dz = pos[2][j] - zi;
+							const float distSq = dx * dx + dy * dy + dz * dz;
+							// A factor rather than a select of the mass and the root of at least the cutoff,
+							// so there is nothing to branch around
+							const float keep = distSq < gravDistSqMin ? 0.f : 1.f;
+							phi[l] += keep * mass[j] / std::sqrt(std::max(distSq, gravDistSqMin));
+						};
+					size_t j = 0;
+					for (; j + potentialLanes <= n; j += potentialLanes)
+					{
+						for (size_t l = 0; l < potentialLanes; ++l)
+							add(j + l, l);
+					}
+					for (; j < n; ++j)
+						add(j, 0);
+					double total = 0;
+					for (size_t l = 0; l < potentialLanes; ++l)
+						total += phi[l];
+					samples[s].potential = (double)mass[i] * total;
+				}
+			});
+
+		double potential = 0;
+		for (const PotentialSample& sample : samples)
+			potential += sample.weight * sample.potential;
+		for (const Partial& sum : partials)
+		{
+			diagnostics.mass += sum.mass;
+			for (int c = 0; c < 3; ++c)
+			{
+				diagnostics.centerOfMass[c] += sum.moment[c];
+				diagnostics.momentum[c] += sum.momentum[c];
+				diagnostics.angularMomentum[c] += sum.angularMomentum[c];
+			}
+			diagnostics.kineticEnergy += sum.kineticEnergy;
+		}
+		if (diagnostics.mass > 0)
+		{
+			for (int c = 0; c < 3; ++c)
+				diagnostics.centerOfMass[c] /= diagnostics.mass;
+		}
+		// Each pair shows up in the potential of both of its bodies
+		diagnostics.potentialEnergy = -0.5 * G * potential;
+
+		const std::chrono::duration<float> time = std::chrono::steady_clock::now() - start;
+		diagnostics.seconds = time.count();
+		return diagnostics;
+	}
+}
@@ -0,0 +1,84 @@
+//
+// Quantities that the physics should keep constant (total momentum,
+// angular momentum, energy) measured after every step, to see how much
+// an integrator drifts without exporting the trajectories. The sums over
+// the bodies are split across the thread pool, each task sums a block of
+// the arrays in double. The potential energy needs every pair, which is
+// as much work as a force evaluation. Unless asked for exactly it is
+// estimated from a sample of the bodies picked by mass: walking the
+// bodies in order, one is taken every M / samples of accumulated mass,
+// and each taken body stands for mass / its own mass of the others.
+// Bodies heavier than that step are always taken and stand only for
+// themselves, so a central star doesn't swing the estimate. The sample
+// only changes when the masses do, so the drift of the estimate over
+// time is still meaningful.
+//
+
+#pragma once
+#include "BodyStore.h"
+#include <vector>
+
+namespace phys
+{
+	struct Diagnostics
+	{
+		double mass = 0;
+		double centerOfMass[3] = {};
+		double momentum[3] = {};
+		double angularMomentum[3] = {}; // about the origin
+		double kineticEnergy = 0;
+		double potentialEnergy = 0;
+		bool potentialExact = true; // false when estimated from a sample of the bodies
+		size_t potentialSamples = 0; // bodies whose potential was summed
+		float seconds = 0; // time the measurement took
+
+		double totalEnergy() const { return kineticEnergy + potentialEnergy; }
+	};
+
+	// Bodies up to which the energy error of a whole run is measured over every pair by
+	// default, past it the exact sum would take longer than the run itself
+	constexpr size_t exactEnergyBodyLimit = 10000;
+
+	class DiagnosticsMeter
+	{
+	public:
+		const Diagnostics& measure(const BodyStore& bodies, float G, bool exactPotential = false);
+		const Diagnostics& getDiagnostics() const { return diagnostics; }
+
+	private:
+		// Sums of one block of bodies
+		struct Partial
+		{
+			double mass = 0;
+			double moment[3] = {}; // mass weighted position
+			double momentum[3] = {};
+			double angularMomentum[3] = {};
+			double kineticEnergy = 0;
+		};
+		// A body whose potential is summed and how many bodies' worth it counts for
+		struct PotentialSample
+		{
+			size_t index;
+			double weight;
+			double potential; // m_i * phi_i
+		};
+
+	private:
+		static constexpr size_t blockSize = 4096; // bodies per task for the sums
+		static constexpr size_t sumCount = 11; // doubles in a Partial
+		static constexpr size_t sumLanes = 4;
+		static constexpr size_t potentialLanes = 16;
+		// The sampled potential costs at most 1 / potentialSampleDivisor of a direct force
+		// evaluation and at most potentialPairBudget pair terms, so it stays small next to
+		// the tree solvers too
+		static constexpr size_t potentialSampleDivisor = 64;
+		static constexpr size_t potentialPairBudget = 1 << 20;
+		static constexpr size_t minPotentialSamples = 64;
+
+	private:
+		Diagnostics diagnostics;
+		// Kept between calls so measuring doesn't allocate
+		std::vector<Partial> partials;
+		std::vector<PotentialSample> samples;
+	};
+}
@@ -0,0 +1,66 @@
+#include "FixedTimestep.h"
+#include <algorithm>
+
+FixedTimestep::FixedTimestep(float rate, int maxSubsteps)
+	: step(1.f / rate)
+	, maxSubsteps(maxSubsteps)
+{
+}
+
+int FixedTimestep::Advance(float frameTime)
+{
+	accumulator += frameTime;
+	int steps = (int)(accumulator / step);
+	if (steps > maxSubsteps)
+	{
+		// Drop what doesn't fit, but keep the fraction so the interpolation stays smooth
+		const float kept = (float)maxSubsteps * step + (accumulator - (float)steps * step);
+		droppedTime += accumulator - kept;
+		accumulator = kept;
+		steps = maxSubsteps;
+	}
+	accumulator -= (float)steps * step;
+	return steps;
+}
+
+float FixedTimestep::GetStep() const
+{
+	return step;
+}
+
+float FixedTimestep::GetAlpha() const
+{
+	return std::clamp(accumulator / step, 0.f, 1.f);
+}
+
+void FixedTimestep::SetRate(float newRate)
+{
+	step = 1.f / std::max(newRate, 1e-3f);
+	accumulator = std::min(accumulator, step);
+}
+
+float FixedTimestep::GetRate() const
+{
+	return 1.f / step;
+}
+
+void FixedTimestep::SetMaxSubsteps(int newMaxSubsteps)
+{
+	maxSubsteps = std::max(newMaxSubsteps, 1);
+}
+
+int FixedTimestep::GetMaxSubsteps() const
+{
+	return maxSubsteps;
+}
+
+float FixedTimestep::GetDroppedTime() const
+{
+	return droppedTime;
+}
+
+void FixedTimestep::Reset()
+{
+	accumulator = 0;
+	droppedTime = 0;
+}
@@ -0,0 +1,33 @@
+//
+// Accumulator that turns variable frame times into a whole number of
+// fixed physics steps. Time beyond the maximum number of steps per frame
+// is dropped, so a slow frame doesn't make the next frames even slower.
+// The time left over is exposed as a fraction of a step, for drawing
+// the objects between the last two physics states.
+//
+
+#pragma once
+
+class FixedTimestep
+{
+public:
+	FixedTimestep(float rate = 120.f, int maxSubsteps = 8);
+	// Adds the frame time and returns the number of steps to run this frame
+	int Advance(float frameTime);
+	// Length of a step in seconds
+	float GetStep() const;
+	// Fraction of a step that is waiting in the accumulator, in [0, 1)
+	float GetAlpha() const;
+	void SetRate(float newRate);
+	float GetRate() const;
+	void SetMaxSubsteps(int newMaxSubsteps);
+	int GetMaxSubsteps() const;
+	// Time thrown away because a frame needed more than the maximum number of steps
+	float GetDroppedTime() const;
+	void Reset();
+private:
+	float step;
+	int maxSubsteps;
+	float accumulator = 0;
+	float droppedTime = 0;
+};
@@ -0,0 +1,683 @@
+#include "FmmSolver.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+
+namespace
+{
+	constexpr int MaxOrder = phys::FmmSolver::MaxOrder;
+
+	constexpr int coeffCountFor(int p)
+	{
+		return (p + 1) * (p + 2) * (p + 3) / 6;
+	}
+	constexpr int MaxCoeffs = coeffCountFor(MaxOrder);
+
+	// All multi-indices n = (nx, ny, nz) with |n| <= MaxOrder sorted by total degree,
+	// so the first coeffCountFor(p) entries are exactly the ones with |n| <= p
+	struct MultiIndexTable
+	{
+		std::array<std::array<int, 3>, MaxCoeffs> n;
+		std::array<int, MaxCoeffs> degree;
+		std::array<double, MaxCoeffs> fact; // nx! * ny! * nz!
+		std::array<double, MaxCoeffs> invFact;
+		int lookup[MaxOrder + 1][MaxOrder + 1][MaxOrder + 1];
+		// Index of n + k (-1 if |n + k| > MaxOrder) and of n - k (-1 if k > n anywhere)
+		std::array<std::array<int16_t, MaxCoeffs>, MaxCoeffs> sum;
+		std::array<std::array<int16_t, MaxCoeffs>, MaxCoeffs> diff;
+
+		MultiIndexTable()
+		{
+			auto factorial = [](int k)
+				{
+					double f = 1;
+					for (int i = 2; i <= k; ++i)
+						f *= i;
+					return f;
+				};
+
+			int idx = 0;
+			for (int d = 0; d <= MaxOrder; ++d)
+			{
+				for (int x = d; x >= 0; --x)
+				{
+					for (int y = d - x; y >= 0; --y)
+					{
+						const int z = d - x - y;
+						n[idx] = { x, y, z };
+						degree[idx] = d;
+						fact[idx] = factorial(x) * factorial(y) * factorial(z);
+						invFact[idx] = 1.0 / fact[idx];
+						lookup[x][y][z] = idx;
+						++idx;
+					}
+				}
+			}
+
+			for (int a = 0; a < MaxCoeffs; ++a)
+			{
+				for (int b = 0; b < MaxCoeffs; ++b)
+				{
+					const auto& na = n[a];
+					const auto& nb = n[b];
+					sum[a][b] = degree[a] + degree[b] <= MaxOrder ? (int16_t)lookup[na[0] + nb[0]][na[1] + nb[1]][na[2] + nb[2]] : -1;
+					diff[a][b] = na[0] >= nb[0] && na[1] >= nb[1] && na[2] >= nb[2] ? (int16_t)lookup[na[0] - nb[0]][na[1] - nb[1]][na[2] - nb[2]] : -1;
+				}
+			}
+		}
+
+		int index(int x, int y, int z) const
+		{
+			return lookup[x][y][z];
+		}
+	};
+
+	const MultiIndexTable& table()
+	{
+		static const MultiIndexTable t;
+		return t;
+	}
+
+	// Powers 0..p of each component of v
+	struct Powers
+	{
+		double v[3][MaxOrder + 1];
+
+		Powers(const double d[3], int p)
+		{
+			for (int a = 0; a < 3; ++a)
+			{
+				v[a][0] = 1.0;
+				for (int k = 1; k <= p; ++k)
+					v[a][k] = v[a][k - 1] * d[a];
+			}
+		}
+
+		double operator()(const std::array<int, 3>& n) const
+		{
+			return v[0][n[0]] * v[1][n[1]] * v[2][n[2]];
+		}
+	};
+
+	// Cartesian derivatives D[n] = d^n/dR^n (1/|R|) for |n| <= p, using the
+	// McMurchie-Davidson recurrence R(m)_{n+e} = n_e R(m+1)_{n-e} + R_e R(m+1)_n
+	void computeDerivatives(const double R[3], int p, double* D)
+	{
+		const auto& t = table();
+		const double invR2 = 1.0 / (R[0] * R[0] + R[1] * R[1] + R[2] * R[2]);
+		double rtab[MaxOrder + 1][MaxCoeffs];
+
+		// rtab[m][0] = (-1)^m (2m-1)!! / r^(2m+1)
+		double f = std::sqrt(invR2);
+		for (int m = 0; m <= p; ++m)
+		{
+			rtab[m][0] = f;
+			f *= -(2.0 * m + 1.0) * invR2;
+		}
+
+		for (int d = 1; d <= p; ++d)
+		{
+			for (int idx = coeffCountFor(d - 1); idx < coeffCountFor(d); ++idx)
+			{
+				const auto& n = t.n[idx];
+				const int a = n[0] > 0 ? 0 : (n[1] > 0 ? 1 : 2);
+				auto nm1 = n;
+				--nm1[a];
+				const int i1 = t.index(nm1[0], nm1[1], nm1[2]);
+				int i2 = -1;
+				if (n[a] >= 2)
+				{
+					auto nm2 = nm1;
+					--nm2[a];
+					i2 = t.index(nm2[0], nm2[1], nm2[2]);
+				}
+				for (int m = 0; m <= p - d; ++m)
+				{
+					double v = R[a] * rtab[m + 1][i1];
+					if (i2 >= 0)
+						v += (n[a] - 1) * rtab[m + 1][i2];
+					rtab[m][idx] = v;
+				}
+			}
+		}
+
+		std::copy(rtab[0], rtab[0] + coeffCountFor(p), D);
+	}
+
+	// Run fn(i) for i in [0, count) on the shared thread pool, one index per task
+	// since leaves and subtrees vary a lot in cost
+	template<typename F>
+	void forEachIndex(size_t count, F&& fn)
+	{
+		phys::parallelFor(count, 1, [&fn](size_t begin, size_t end)
+			{
+				for (size_t i = begin; i < end; ++i)
+					fn(i);
+			});
+	}
+}
+
+namespace phys
+{
+	void FmmSolver::setOrder(int newOrder)
+	{
+		expansionOrder = std::clamp(newOrder, 1, MaxOrder);
+		coeffCount = coeffCountFor(expansionOrder);
+	}
+
+	int FmmSolver::getOrder() const
+	{
+		return expansionOrder;
+	}
+
+	void FmmSolver::setTheta(float newTheta)
+	{
+		theta = newTheta;
+	}
+
+	float FmmSolver::getTheta() const
+	{
+		return theta;
+	}
+
+	void FmmSolver::build(const std::vector<State>& states, const std::vector<float>& masses, float newG)
+	{
+		using namespace DirectX;
+		G = newG;
+		const uint32_t n = (uint32_t)states.size();
+		nodes.clear();
+		nearPairs.clear();
+		leaves.clear();
+		positions.resize(n);
+		bodyMasses.resize(n);
+		order.resize(n);
+		scratch.resize(n);
+		leafOf.resize(n);
+		slotOf.resize(n);
+		if (n == 0)
+			return;
+
+		double lo[3], hi[3];
+		for (uint32_t i = 0; i < n; ++i)
+		{
+			XMStoreFloat3(&positions[i], states[i].position);
+			bodyMasses[i] = masses[i];
+			order[i] = i;
+			const double p[3] = { positions[i].x, positions[i].y, positions[i].z };
+			for (int a = 0; a < 3; ++a)
+			{
+				lo[a] = i == 0 ? p[a] : std::min(lo[a], p[a]);
+				hi[a] = i == 0 ? p[a] : std::max(hi[a], p[a]);
+			}
+		}
+		const double center[3] = { 0.5 * (lo[0] + hi[0]), 0.5 * (lo[1] + hi[1]), 0.5 * (lo[2] + hi[2]) };
+		const double halfSize = 0.5 * std::max({ hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2] }) + 1e-3;
+
+		nodes.reserve(2 * n / leafCapacity + 1);
+		nodes.emplace_back();
+		buildNode(0, 0, n, center, halfSize, 0);
+
+		for (uint32_t slot = 0; slot < n; ++slot)
+			slotOf[order[slot]] = slot;
+
+		multipoles.assign(nodes.size() * coeffCount, 0.0);
+		locals.assign(nodes.size() * coeffCount, 0.0);
+
+		upwardPass();
+		dualTreeWalk();
+		downwardPass();
+	}
+
+	void FmmSolver::buildNode(uint32_t idx, uint32_t begin, uint32_t end, const double center[3], double halfSize, uint32_t depth)
+	{
+		nodes[idx].begin = begin;
+		nodes[idx].count = end - begin;
+
+		if (end - begin <= leafCapacity || depth >= maxDepth)
+		{
+			leaves.push_back(idx);
+			for (uint32_t slot = begin; slot < end; ++slot)
+				leafOf[order[slot]] = idx;
+			return;
+		}
+
+		// Bucket the bodies into octants (counting sort through the scratch buffer)
+		auto octant = [&](uint32_t b)
+			{
+				const auto& pos = positions[b];
+				return (pos.x > center[0] ? 1u : 0u) | (pos.y > center[1] ? 2u : 0u) | (pos.z > center[2] ? 4u : 0u);
+			};
+		std::array<uint32_t, 9> offsets = {};
+		for (uint32_t slot = begin; slot < end; ++slot)
+			++offsets[octant(order[slot]) + 1];
+		for (uint32_t o = 0; o < 8; ++o)
+			offsets[o + 1] += offsets[o];
+		std::array<uint32_t, 8> cursor;
+		std::copy(offsets.begin(), offsets.begin() + 8, cursor.begin());
+		for (uint32_t slot = begin; slot < end; ++slot)
+			scratch[begin + cursor[octant(order[slot])]++] = order[slot];
+		std::copy(scratch.begin() + begin, scratch.begin() + end, order.begin() + begin);
+
+		const uint32_t firstChild = (uint32_t)nodes.size();
+		uint32_t childCount = 0;
+		for (uint32_t o = 0; o < 8; ++o)
+			childCount += offsets[o + 1] > offsets[o] ? 1 : 0;
+		nodes.resize(nodes.size() + childCount);
+		nodes[idx].firstChild = firstChild;
+		nodes[idx].childCount = childCount;
+
+		const double childHalf = 0.5 * halfSize;
+		uint32_t child = firstChild;
+		for (uint32_t o = 0; o < 8; ++o)
+		{
+			if (offsets[o + 1] == offsets[o])
+				continue;
+			const double childCenter[3] = {
+				center[0] + ((o & 1) ? childHalf : -childHalf),
+				center[1] + ((o & 2) ? childHalf : -childHalf),
+				center[2] + ((o & 4) ? childHalf : -childHalf) };
+			buildNode(child++, begin + offsets[o], begin + offsets[o + 1], childCenter, childHalf, depth + 1);
+		}
+	}
+
+	void FmmSolver::upwardPass()
+	{
+		const auto& t = table();
+
+		// Children always come after their parent, so walking backwards is a post-order walk
+		for (size_t i = nodes.size(); i-- > 0;)
+		{
+			Node& node = nodes[i];
+			double* M = multipole((uint32_t)i);
+
+			if (node.childCount == 0)
+			{
+				// P2M
+				for (uint32_t slot = node.begin; slot < node.begin + node.count; ++slot)
+				{
+					const auto& p = positions[order[slot]];
+					const double m = bodyMasses[order[slot]];
+					node.mass += m;
+					node.com[0] += m * p.x;
+					node.com[1] += m * p.y;
+					node.com[2] += m * p.z;
+				}
+				if (node.mass > 0)
+					for (int a = 0; a < 3; ++a)
+						node.com[a] /= node.mass;
+
+				for (uint32_t slot = node.begin; slot < node.begin + node.count; ++slot)
+				{
+					const auto& p = positions[order[slot]];
+					const double d[3] = { p.x - node.com[0], p.y - node.com[1], p.z - node.com[2] };
+					node.rmax = std::max(node.rmax, std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]));
+					const Powers pw(d, expansionOrder);
+					const double m = bodyMasses[order[slot]];
+					for (int k = 0; k < coeffCount; ++k)
+						M[k] += m * pw(t.n[k]) * t.invFact[k];
+				}
+				continue;
+			}
+
+			// M2M
+			for (uint32_t c = node.firstChild; c < node.firstChild + node.childCount; ++c)
+			{
+				node.mass += nodes[c].mass;
+				for (int a = 0; a < 3; ++a)
+					node.com[a] += nodes[c].mass * nodes[c].com[a];
+			}
+			if (node.mass > 0)
+				for (int a = 0; a < 3; ++a)
+					node.com[a] /= node.mass;
+
+			for (uint32_t c = node.firstChild; c < node.firstChild + node.childCount; ++c)
+			{
+				const Node& ch = nodes[c];
+				const double s[3] = { ch.com[0] - node.com[0], ch.com[1] - node.com[1], ch.com[2] - node.com[2] };
+				node.rmax = std::max(node.rmax, ch.rmax + std::sqrt(s[0] * s[0] + s[1] * s[1] + s[2] * s[2]));
+				const Powers pw(s, expansionOrder);
+				const double* Mc = multipole(c);
+				for (int nIdx = 0; nIdx < coeffCount; ++nIdx)
+				{
+					double sum = 0;
+					for (int kIdx = 0; kIdx < coeffCountFor(t.degree[nIdx]); ++kIdx)
+					{
+						const int d = t.diff[nIdx][kIdx];
+						if (d >= 0)
+							sum += Mc[kIdx] * pw(t.n[d]) * t.invFact[d];
+					}
+					M[nIdx] += sum;
+				}
+			}
+		}
+	}
+
+	void FmmSolver::dualTreeWalk()
+	{
+		const float theta2 = theta * theta;
+		auto& stack = walkStack;
+		stack.clear();
+		stack.emplace_back(0u, 0u);
+
+		while (!stack.empty())
+		{
+			const auto [a, b] = stack.back();
+			stack.pop_back();
+			const Node& A = nodes[a];
+			const Node& B = nodes[b];
+
+			if (a == b)
+			{
+				if (A.childCount == 0)
+				{
+					nearPairs.emplace_back(a, a);
+					continue;
+				}
+				for (uint32_t i = 0; i < A.childCount; ++i)
+					for (uint32_t j = i; j < A.childCount; ++j)
+						stack.emplace_back(A.firstChild + i, A.firstChild + j);
+				continue;
+			}
+
+			const double dx = A.com[0] - B.com[0];
+			const double dy = A.com[1] - B.com[1];
+			const double dz = A.com[2] - B.com[2];
+			const double distSq = dx * dx + dy * dy + dz * dz;
+			const double rSum = A.rmax + B.rmax;
+
+			if (rSum * rSum < theta2 * distSq)
+			{
+				interactFar(a, b);
+			}
+			else if (A.childCount == 0 && B.childCount == 0)
+			{
+				nearPairs.emplace_back(a, b);
+			}
+			else
+			{
+				// Split the bigger node
+				const bool splitA = B.childCount == 0 || (A.childCount != 0 && A.rmax >= B.rmax);
+				const Node& S = splitA ? A : B;
+				const uint32_t other = splitA ? b : a;
+				for (uint32_t c = S.firstChild; c < S.firstChild + S.childCount; ++c)
+					stack.emplace_back(c, other);
+			}
+		}
+
+		// Compressed near field lists so every leaf can be evaluated on its own
+		nearOffsets.assign(nodes.size() + 1, 0);
+		for (const auto& [a, b] : nearPairs)
+		{
+			++nearOffsets[a + 1];
+			if (a != b)
+				++nearOffsets[b + 1];
+		}
+		for (size_t i = 0; i < nodes.size(); ++i)
+			nearOffsets[i + 1] += nearOffsets[i];
+		nearLeaves.resize(nearOffsets.back());
+		auto& fill = nearFill;
+		fill.assign(nearOffsets.begin(), nearOffsets.end() - 1);
+		for (const auto& [a, b] : nearPairs)
+		{
+			nearLeaves[fill[a]++] = b;
+			if (a != b)
+				nearLeaves[fill[b]++] = a;
+		}
+	}
+
+	void FmmSolver::interactFar(uint32_t a, uint32_t b)
+	{
+		// Mutual M2L, the derivatives are computed once for both directions
+		const auto& t = table();
+		const double R[3] = {
+			nodes[a].com[0] - nodes[b].com[0],
+			nodes[a].com[1] - nodes[b].com[1],
+			nodes[a].com[2] - nodes[b].com[2] };
+		double D[MaxCoeffs];
+		computeDerivatives(R, expansionOrder, D);
+
+		const double* Ma = multipole(a);
+		const double* Mb = multipole(b);
+		double* La = local(a);
+		double* Lb = local(b);
+
+		for (int kIdx = 0; kIdx < coeffCount; ++kIdx)
+		{
+			const auto& sumIdx = t.sum[kIdx];
+			double sumA = 0, sumB = 0;
+			for (int nIdx = 0; nIdx < coeffCountFor(expansionOrder - t.degree[kIdx]); ++nIdx)
+			{
+				const double d = D[sumIdx[nIdx]];
+				sumA += ((t.degree[nIdx] & 1) ? -Mb[nIdx] : Mb[nIdx]) * d;
+				sumB += Ma[nIdx] * d;
+			}
+			La[kIdx] += sumA * t.invFact[kIdx];
+			Lb[kIdx] += ((t.degree[kIdx] & 1) ? -sumB : sumB) * t.invFact[kIdx];
+		}
+	}
+
+	void FmmSolver::downwardPass()
+	{
+		// Hand the locals down serially until there is enough independent subtrees
+		// to keep every thread busy, then finish each subtree in parallel. Where
+		// the split happens doesn't change the result, every local gets the
+		// same L2L from its parent either way.
+		const size_t target = 8 * phys::ThreadPool::get().threadCount();
+		frontier.assign(1, 0u);
+		bool expanded = true;
+		while (frontier.size() < target && expanded)
+		{
+			expanded = false;
+			nextFrontier.clear();
+			for (uint32_t idx : frontier)
+			{
+				const Node& node = nodes[idx];
+				if (node.childCount == 0)
+				{
+					nextFrontier.push_back(idx);
+					continue;
+				}
+				downward(idx);
+				for (uint32_t c = node.firstChild; c < node.firstChild + node.childCount; ++c)
+					nextFrontier.push_back(c);
+				expanded = true;
+			}
+			frontier.swap(nextFrontier);
+		}
+
+		forEachIndex(frontier.size(), [this](size_t i)
+			{
+				downwardSubtree(frontier[i]);
+			});
+	}
+
+	void FmmSolver::downwardSubtree(uint32_t idx)
+	{
+		// Recursive L2L over the whole subtree, no deeper than maxDepth
+		downward(idx);
+		for (uint32_t c = nodes[idx].firstChild; c < nodes[idx].firstChild + nodes[idx].childCount; ++c)
+			downwardSubtree(c);
+	}
+
+	void FmmSolver::downward(uint32_t idx)
+	{
+		// L2L into every child of idx
+		const auto& t = table();
+		const Node& node = nodes[idx];
+		const double* L = local(idx);
+
+		for (uint32_t c = node.firstChild; c < node.firstChild + node.childCount; ++c)
+		{
+			const double s[3] = { nodes[c].com[0] - node.com[0], nodes[c].com[1] - node.com[1], nodes[c].com[2] - node.com[2] };
+			const Powers pw(s, expansionOrder);
+			double* Lc = local(c);
+			for (int jIdx = 0; jIdx < coeffCount; ++jIdx)
+			{
+				double sum = 0;
+				for (int kIdx = jIdx; kIdx < coeffCount; ++kIdx)
+				{
+					const int d = t.diff[kIdx][jIdx];
+					if (d < 0)
+						continue;
+					// binomial k! / (j! (k-j)!)
+					const double binom = t.fact[kIdx] * t.invFact[jIdx] * t.invFact[d];
+					sum += L[kIdx] * binom * pw(t.n[d]);
+				}
+				Lc[jIdx] += sum;
+			}
+		}
+	}
+
+	void FmmSolver::evaluateLeaf(uint32_t leaf, const double p[3], uint32_t skipSlot, double acc[3]) const
+	{
+		const auto& t = table();
+		const Node& node = nodes[leaf];
+		const double* L = local(leaf);
+
+		// L2P, gradient of the local expansion
+		const double e[3] = { p[0] - node.com[0], p[1] - node.com[1], p[2] - node.com[2] };
+		const Powers pw(e, expansionOrder);
+		double ax = 0, ay = 0, az = 0;
+		for (int kIdx = 1; kIdx < coeffCount; ++kIdx)
+		{
+			const auto& k = t.n[kIdx];
+			if (k[0] > 0)
+				ax += L[kIdx] * k[0] * pw.v[0][k[0] - 1] * pw.v[1][k[1]] * pw.v[2][k[2]];
+			if (k[1] > 0)
+				ay += L[kIdx] * k[1] * pw.v[0][k[0]] * pw.v[1][k[1] - 1] * pw.v[2][k[2]];
+			if (k[2] > 0)
+				az += L[kIdx] * k[2] * pw.v[0][k[0]] * pw.v[1][k[1]] * pw.v[2][k[2] - 1];
+		}
+
+		// P2P with the leaves that were too close for the far field
+		for (uint32_t i = nearOffsets[leaf]; i < nearOffsets[leaf + 1]; ++i)
+		{
+			const Node& other = nodes[nearLeaves[i]];
+			for (uint32_t slot = other.begin; slot < other.begin + other.count; ++slot)
+			{
+				if (slot == skipSlot)
+					continue;
+				const uint32_t b = order[slot];
+				const double dx = positions[b].x - p[0];
+				const double dy = positions[b].y - p[1];
+				const double dz = positions[b].z - p[2];
+				const double distSq = dx * dx + dy * dy + dz * dz;
+				if (distSq < gravDistSqMin)
+					continue;
+				const double s = bodyMasses[b] / (distSq * std::sqrt(distSq));
+				ax += dx * s; ay += dy * s; az += dz * s;
+			}
+		}
+
+		acc[0] = G * ax;
+		acc[1] = G * ay;
+		acc[2] = G * az;
+	}
+
+	void FmmSolver::computeAccelerations(std::vector<DirectX::XMFLOAT3>& out) const
+	{
+		out.resize(positions.size());
+		forEachIndex(leaves.size(), [this, &out](size_t i)
+			{
+				const uint32_t leaf = leaves[i];
+				const Node& node = nodes[leaf];
+				for (uint32_t slot = node.begin; slot < node.begin + node.count; ++slot)
+				{
+					const uint32_t b = order[slot];
+					const double p[3] = { positions[b].x, positions[b].y, positions[b].z };
+					double acc[3];
+					evaluateLeaf(leaf, p, slot, acc);
+					out[b] = { (float)acc[0], (float)acc[1], (float)acc[2] };
+				}
+			});
+	}
+
+	DirectX::XMVECTOR FmmSolver::computeAcceleration(DirectX::FXMVECTOR pos, size_t selfIndex) const
+	{
+		using namespace DirectX;
+		if (selfIndex >= leafOf.size())
+			return XMVectorZero();
+
+		XMFLOAT3 pf;
+		XMStoreFloat3(&pf, pos);
+		const double p[3] = { pf.x, pf.y, pf.z };
+		double acc[3];
+		evaluateLeaf(leafOf[selfIndex], p, slotOf[selfIndex], acc);
+		return XMVectorSet((float)acc[0], (float)acc[1], (float)acc[2], 0.f);
+	}
+
+	std::vector<FmmComparison> compareFmmWithDirect(const std::vector<State>& states,
+		const std::vector<float>& masses,
+		float G, float theta, int maxOrder, size_t sampleCount)
+	{
+		using namespace DirectX;
+		using clock = std::chrono::steady_clock;
+		std::vector<FmmComparison> results;
+		const size_t n = states.size();
+		if (n < 2 || sampleCount == 0)
+			return results;
+
+		std::vector<XMFLOAT3> pos(n);
+		for (size_t i = 0; i < n; ++i)
+			XMStoreFloat3(&pos[i], states[i].position);
+
+		// Reference accelerations on evenly spread targets, in double precision
+		const size_t stride = std::max<size_t>(1, n / sampleCount);
+		std::vector<size_t> targets;
+		for (size_t i = 0; i < n; i += stride)
+			targets.push_back(i);
+		std::vector<std::array<double, 3>> reference(targets.size());
+
+		auto start = clock::now();
+		for (size_t t = 0; t < targets.size(); ++t)
+		{
+			const size_t i = targets[t];
+			double ax = 0, ay = 0, az = 0;
+			for (size_t j = 0; j < n; ++j)
+			{
+				if (j == i)
+					continue;
+				const double dx = (double)pos[j].x - pos[i].x;
+				const double dy = (double)pos[j].y - pos[i].y;
+				const double dz = (double)pos[j].z - pos[i].z;
+				const double distSq = dx * dx + dy * dy + dz * dz;
+				if (distSq < gravDistSqMin)
+					continue;
+				const double s = masses[j] / (distSq * std::sqrt(distSq));
+				ax += dx * s; ay += dy * s; az += dz * s;
+			}
+			reference[t] = { G * ax, G * ay, G * az };
+		}
+		const std::chrono::duration<double> directTime = clock::now() - start;
+		const double directSeconds = directTime.count() * (double)n / (double)targets.size();
+
+		FmmSolver solver;
+		solver.setTheta(theta);
+		std::vector<XMFLOAT3> acc;
+		for (int p = 1; p <= std::min(maxOrder, FmmSolver::MaxOrder); ++p)
+		{
+			solver.setOrder(p);
+			start = clock::now();
+			solver.build(states, masses, G);
+			solver.computeAccelerations(acc);
+			const std::chrono::duration<double> fmmTime = clock::now() - start;
+
+			double sumSq = 0, maxErr = 0;
+			for (size_t t = 0; t < targets.size(); ++t)
+			{
+				const auto& r = reference[t];
+				const auto& a = acc[targets[t]];
+				const double ex = a.x - r[0], ey = a.y - r[1], ez = a.z - r[2];
+				const double refNorm = std::sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+				const double rel = refNorm > 0 ? std::sqrt(ex * ex + ey * ey + ez * ez) / refNorm : 0.0;
+				sumSq += rel * rel;
+				maxErr = std::max(maxErr, rel);
+			}
+			results.push_back({ p, std::sqrt(sumSq / targets.size()), maxErr, fmmTime.count(), directSeconds });
+		}
+		return results;
+	}
+}
@@ -0,0 +1,129 @@
+//
+// Fast multipole method for the gravity between all bodies.
+// Uses cartesian taylor expansions of 1/r up to a configurable order,
+// a dual-tree traversal to find the interactions and a parallel
+// downward pass to hand the far field down to the leaves.
+//
+
+#pragma once
+#include "PhysEngine.h"
+#include <vector>
+#include <cstdint>
+
+namespace phys
+{
+	class FmmSolver
+	{
+	public:
+		static constexpr int MaxOrder = 8;
+
+		// Expansion order, higher is more accurate and slower (1 = monopole only)
+		void setOrder(int newOrder);
+		int getOrder() const;
+		// Opening angle for the multipole acceptance criterion
+		void setTheta(float newTheta);
+		float getTheta() const;
+
+		// Build the tree from the frozen states and compute the far field of every leaf
+		void build(const std::vector<State>& states, const std::vector<float>& masses, float G);
+		// Acceleration of every body caused by all others, indexed like the states passed to build
+		void computeAccelerations(std::vector<DirectX::XMFLOAT3>& out) const;
+		// Acceleration at pos for a body that sits near its position at build time,
+		// selfIndex is skipped in the near field
+		DirectX::XMVECTOR computeAcceleration(DirectX::FXMVECTOR pos, size_t selfIndex) const;
+
+	private:
+		struct Node
+		{
+			double com[3] = { 0,0,0 }; // expansion center (center of mass)
+			double mass = 0;
+			double rmax = 0; // radius around com containing every body of the node
+			uint32_t begin = 0; // first slot in order
+			uint32_t count = 0;
+			uint32_t firstChild = 0;
+			uint32_t childCount = 0;
+		};
+
+		void buildNode(uint32_t idx, uint32_t begin, uint32_t end, const double center[3], double halfSize, uint32_t depth);
+		void upwardPass();
+		void dualTreeWalk();
+		void downwardPass();
+		void interactFar(uint32_t a, uint32_t b);
+		void downward(uint32_t idx);
+		void downwardSubtree(uint32_t idx);
+		// Far field (L2P) plus near field (P2P) of a leaf at an arbitrary point
+		void evaluateLeaf(uint32_t leaf, const double p[3], uint32_t skipSlot, double acc[3]) const;
+		double* multipole(uint32_t idx) { return &multipoles[(size_t)idx * coeffCount]; }
+		const double* multipole(uint32_t idx) const { return &multipoles[(size_t)idx * coeffCount]; }
+		double* local(uint32_t idx) { return &locals[(size_t)idx * coeffCount]; }
+		const double* local(uint32_t idx) const { return &locals[(size_t)idx * coeffCount]; }
+
+		static constexpr uint32_t leafCapacity = 16;
+		static constexpr uint32_t maxDepth = 24;
+
+	private:
+		int expansionOrder = 4;
+		int coeffCount = 35; // number of multi-indices with |n| <= order
+		float theta = 0.5f;
+		float G = 1.f;
+
+		std::vector<Node> nodes;
+		std::vector<double> multipoles; // coeffCount per node
+		std::vector<double> locals; // coeffCount per node
+		std::vector<DirectX::XMFLOAT3> positions; // indexed by body
+		std::vector<float> bodyMasses;
+		std::vector<uint32_t> order; // tree slot -> body index
+		std::vector<uint32_t> scratch;
+		std::vector<uint32_t> leafOf; // body index -> leaf node
+		std::vector<uint32_t> slotOf; // body index -> tree slot
+		// Near field leaves of every leaf (compressed rows indexed by node)
+		std::vector<std::pair<uint32_t, uint32_t>> nearPairs;
+		std::vector<uint32_t> nearOffsets;
+		std::vector<uint32_t> nearLeaves;
+		std::vector<uint32_t> leaves;
+		// Working memory of the passes, kept so that rebuilding every step doesn't allocate
+		std::vector<std::pair<uint32_t, uint32_t>> walkStack;
+		std::vector<uint32_t> nearFill;
+		std::vector<uint32_t> frontier;
+		std::vector<uint32_t> nextFrontier;
+	};
+
+	// Gravitational force evaluated from a built FMM solver
+	class FmmGravForce
+	{
+	public:
+		FmmGravForce(const FmmSolver& solver, size_t selfIndex, float mass)
+			:
+			solver(solver)
+			, selfIndex(selfIndex)
+			, mass(mass)
+		{
+		}
+
+		DirectX::XMVECTOR compute(const State& state) const
+		{
+			return DirectX::XMVectorScale(solver.computeAcceleration(state.position, selfIndex), mass);
+		}
+
+	private:
+		const FmmSolver& solver;
+		size_t selfIndex;
+		float mass;
+	};
+
+	// Result of comparing one expansion order against the direct sum
+	struct FmmComparison
+	{
+		int order;
+		double rmsRelError; // rms of |a_fmm - a_direct| / |a_direct|
+		double maxRelError;
+		double fmmSeconds; // build + evaluation of every body
+		double directSeconds; // direct sum over every body (extrapolated from the sampled targets)
+	};
+
+	// Runs the FMM at every order from 1 to maxOrder on the given bodies and compares
+	// it against a direct sum over up to sampleCount target bodies
+	std::vector<FmmComparison> compareFmmWithDirect(const std::vector<State>& states,
+		const std::vector<float>& masses,
+		float G, float theta, int maxOrder, size_t sampleCount = 1000);
+}
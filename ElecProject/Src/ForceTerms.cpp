@@ -0,0 +1,180 @@
+#include "ForceTerms.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <memory>
+
+namespace phys
+{
+	namespace
+	{
+		// The old way of calling the forces: an interface per term and a
+		// std::function per body, neither can be inlined into the integrator
+		class BodyTerm
+		{
+		public:
+			virtual void accumulate(const ForceBatch& b, size_t i, float& ax, float& ay, float& az) const = 0;
+			virtual ~BodyTerm() = default;
+		};
+
+		template<typename Term>
+		class VirtualTerm : public BodyTerm
+		{
+		public:
+			explicit VirtualTerm(const Term& term)
+				:
+				term(term)
+			{
+			}
+
+			void accumulate(const ForceBatch& b, size_t i, float& ax, float& ay, float& az) const override
+			{
+				term.accumulate(b, i, ax, ay, az);
+			}
+
+		private:
+			Term term;
+		};
+
+		// Runs the steps from the given states, returns the seconds they took.
+		// stepFn(pos, vel, mass, n, dt, scratch, cache) advances the bodies by one step
+		template<typename StepFn>
+		double timeSteps(const std::vector<State>& states, const std::vector<float>& masses, int steps,
+			std::vector<float>& pos, StepFn&& stepFn)
+		{
+			const size_t n = states.size();
+			pos.resize(6 * n);
+			for (size_t i = 0; i < n; ++i)
+			{
+				DirectX::XMFLOAT3 p, v;
+				DirectX::XMStoreFloat3(&p, states[i].position);
+				DirectX::XMStoreFloat3(&v, states[i].velocity);
+				pos[i] = p.x; pos[n + i] = p.y; pos[2 * n + i] = p.z;
+				pos[3 * n + i] = v.x; pos[4 * n + i] = v.y; pos[5 * n + i] = v.z;
+			}
+			float* const p[3] = { pos.data(), pos.data() + n, pos.data() + 2 * n };
+			float* const v[3] = { pos.data() + 3 * n, pos.data() + 4 * n, pos.data() + 5 * n };
+
+			ScratchArena scratch;
+			AccelerationCache cache;
+			const auto start = std::chrono::steady_clock::now();
+			for (int s = 0; s < steps; ++s)
+			{
+				scratch.reset();
+				stepFn(p, v, masses.data(), n, 1.f / 120.f, scratch, cache);
+			}
+			return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+
+		// RK4 steps with the accelerations of computeAccel
+		template<typename AccelFn>
+		auto rk4With(AccelFn computeAccel)
+		{
+			return [computeAccel](float* const p[3], float* const v[3], const float* mass, size_t n, float dt,
+				ScratchArena& scratch, AccelerationCache& cache)
+				{
+					RK4::step(p, v, mass, n, dt, scratch, cache, computeAccel);
+				};
+		}
+
+		template<typename... Terms>
+		ForceDispatchComparison compareSet(const char* name, const std::vector<State>& states,
+			const std::vector<float>& masses, int steps, const Terms&... termList)
+		{
+			ForceDispatchComparison result;
+			result.forces = name;
+			result.steps = steps;
+			const size_t n = states.size();
+
+			std::vector<std::unique_ptr<BodyTerm>> terms;
+			(terms.push_back(std::make_unique<VirtualTerm<Terms>>(termList)), ...);
+			const std::function<void(const ForceBatch&, size_t, float&, float&, float&)> bodyAccel =
+				[&terms](const ForceBatch& b, size_t i, float& ax, float& ay, float& az)
+				{
+					for (const auto& term : terms)
+						term->accumulate(b, i, ax, ay, az);
+				};
+			auto typeErased = [&](const float* const p[3], const float* const v[3], float* const a[3])
+				{
+					const ForceBatch batch(n, p, v, masses.data());
+					parallelFor(n, 256, [&](size_t begin, size_t end)
+						{
+							for (size_t i = begin; i < end; ++i)
+							{
+								float ax = 0, ay = 0, az = 0;
+								bodyAccel(batch, i, ax, ay, az);
+								a[0][i] = ax; a[1][i] = ay; a[2][i] = az;
+							}
+						});
+				};
+
+			const ForceSet<Terms...> forces(termList...);
+			auto fused = [&forces](float* const p[3], float* const v[3], const float* mass, size_t n, float dt,
+				ScratchArena& scratch, AccelerationCache& cache)
+				{
+					Integrator<RK4, ForceSet<Terms...>>::step(p, v, mass, n, dt, scratch, cache, forces);
+				};
+
+			std::vector<float> erasedState, fusedState;
+			result.typeErasedSeconds = timeSteps(states, masses, steps, erasedState, rk4With(typeErased));
+			result.fusedSeconds = timeSteps(states, masses, steps, fusedState, fused);
+			for (size_t k = 0; k < 3 * n; ++k)
+				result.maxDifference = std::max(result.maxDifference, std::abs(erasedState[k] - fusedState[k]));
+			return result;
+		}
+	}
+
+	std::vector<ForceDispatchComparison> compareForceDispatch(const std::vector<State>& states,
+		const std::vector<float>& masses,
+		float G, float boundingSphereSize, int steps)
+	{
+		std::vector<ForceDispatchComparison> results;
+		const size_t n = states.size();
+		if (n == 0 || steps <= 0)
+			return results;
+
+		const Gravity gravity{ G };
+		const BoundingSphere boundary{ boundingSphereSize };
+		results.push_back(compareSet("Gravity + bounding sphere", states, masses, steps, gravity, boundary));
+		// Cheap enough to run many more steps in the same time
+		results.push_back(compareSet("Bounding sphere", states, masses, steps * 100, boundary));
+		return results;
+	}
+
+	DeterminismComparison compareDeterminism(const std::vector<State>& states,
+		const std::vector<float>& masses,
+		float G, int steps)
+	{
+		DeterminismComparison result;
+		const size_t n = states.size();
+		if (n == 0 || steps <= 0)
+			return result;
+
+		ThreadPool& shared = ThreadPool::get();
+		ThreadPool single(0);
+		auto pairwiseOn = [&](ThreadPool& pool, bool deterministic)
+			{
+				return [&pool, &masses, n, G, deterministic](const float* const p[3], const float* const[3], float* const a[3])
+					{
+						computeGravityPairwise(pool, p[0], p[1], p[2], masses.data(), n, G, a[0], a[1], a[2], deterministic);
+					};
+			};
+		// Bitwise, a difference in the last bit is what this is about
+		auto same = [](const std::vector<float>& a, const std::vector<float>& b)
+			{
+				return std::memcmp(a.data(), b.data(), a.size() * sizeof(float)) == 0;
+			};
+
+		std::vector<float> fastState, deterministicState, singleFast, singleDeterministic;
+		result.steps = steps;
+		result.threads = shared.threadCount();
+		result.fastSeconds = timeSteps(states, masses, steps, fastState, rk4With(pairwiseOn(shared, false)));
+		result.deterministicSeconds = timeSteps(states, masses, steps, deterministicState, rk4With(pairwiseOn(shared, true)));
+		timeSteps(states, masses, steps, singleFast, rk4With(pairwiseOn(single, false)));
+		timeSteps(states, masses, steps, singleDeterministic, rk4With(pairwiseOn(single, true)));
+		result.fastMatchesSingleThread = same(fastState, singleFast);
+		result.deterministicMatchesSingleThread = same(deterministicState, singleDeterministic);
+		return result;
+	}
+}
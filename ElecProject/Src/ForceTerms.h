@@ -0,0 +1,343 @@
+//
+// Forces put together at compile time and evaluated for a whole batch of
+// bodies in one call. A ForceSet<Terms...> takes spans of positions,
+// velocities and masses and writes one acceleration array. Its terms are
+// template parameters, so the whole sum is inlined instead of going
+// through std::function and a virtual call per term and body.
+// There are two kinds of terms:
+// - at most one batch term, compute(batch, a), that fills the
+//   accelerations itself, e.g. gravity through the tiled SIMD kernels
+// - any number of body terms, accumulate(batch, i, ax, ay, az), that
+//   are applied in order, all of them in a single pass over the bodies
+//	ForceSet forces(DirectGravity{ G }, AccelerationLimit{}, BoundingSphere{ 500.f }, Drag{ 0.1f });
+//	Integrator<RK4, decltype(forces)>::step(pos, vel, mass, n, dt, scratch, cache, forces);
+// Batches and body terms work on float or double state alike, the batched
+// gravity kernels only on float.
+//
+
+#pragma once
+#include "Integrators.h"
+#include "GravityKernels.h"
+#include "ThreadPool.h"
+#include "Precision.h"
+#include <cmath>
+#include <cstdint>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace phys
+{
+	// The bodies a force evaluation works on. Every body in [0, n) pulls, the
+	// accelerations are computed for the bodies active[0..count), a[c][k] being
+	// the one of body active[k]. A null active list means all n bodies.
+	template<typename Real>
+	struct BasicForceBatch
+	{
+		using Scalar = Real;
+
+		size_t n;
+		const Real* const* pos; // x, y, z arrays
+		const Real* const* vel;
+		const float* mass;
+		const uint32_t* active;
+		size_t count;
+
+		BasicForceBatch(size_t n, const Real* const pos[3], const Real* const vel[3], const float* mass,
+			const uint32_t* active = nullptr, size_t count = 0)
+			:
+			n(n)
+			, pos(pos)
+			, vel(vel)
+			, mass(mass)
+			, active(active)
+			, count(active ? count : n)
+		{
+		}
+
+		size_t index(size_t k) const { return active ? active[k] : k; }
+	};
+
+	using ForceBatch = BasicForceBatch<float>;
+
+	template<typename T>
+	concept BatchForceTerm = requires(const T& term, const ForceBatch& batch, float* const a[3])
+	{
+		term.compute(batch, a);
+	};
+
+	template<typename T>
+	concept BodyForceTerm = requires(const T& term, const ForceBatch& batch, float& f)
+	{
+		term.accumulate(batch, size_t(0), f, f, f);
+	};
+
+	// Newtonian gravity through the batched kernels of GravityKernels.h
+	struct DirectGravity
+	{
+		float G;
+		bool pairwise = false; // each pair once for both bodies, only when every body is active
+		bool deterministic = false; // pairwise sums in the same order on any number of threads
+
+		void compute(const ForceBatch& b, float* const a[3]) const
+		{
+			const float* const* p = b.pos;
+			if (b.active)
+				computeGravityIndexed(b.active, b.count, p[0], p[1], p[2], b.mass, b.n, G, a[0], a[1], a[2]);
+			else if (pairwise)
+				computeGravityPairwise(p[0], p[1], p[2], b.mass, b.n, G, a[0], a[1], a[2], deterministic);
+			else
+				computeGravity(p[0], p[1], p[2], p[0], p[1], p[2], b.mass, b.n, G, a[0], a[1], a[2]);
+		}
+	};
+
+	// Batch term from any callable fn(const BasicForceBatch<Real>&, Real* const a[3]),
+	// for solvers that keep state between evaluations such as the trees
+	template<typename Fn>
+	struct BatchForce
+	{
+		Fn fn;
+
+		template<typename Real>
+		void compute(const BasicForceBatch<Real>& b, Real* const a[3]) const
+		{
+			fn(b, a);
+		}
+	};
+
+	// Newtonian gravity of every body on body i, summed directly one body at a time.
+	// The compensated sum carries the rounding error of each addition over to the
+	// next one (Kahan), so the float sum of many small pulls stays close to exact.
+	struct Gravity
+	{
+		float G;
+		bool compensated = false;
+
+		template<typename Real>
+		void accumulate(const BasicForceBatch<Real>& b, size_t i, Real& ax, Real& ay, Real& az) const
+		{
+			Real sx, sy, sz;
+			if (compensated)
+				sumCompensated(b, i, sx, sy, sz);
+			else
+				sum(b, i, sx, sy, sz);
+			sx *= G; sy *= G; sz *= G;
+			clampAcceleration(sx, sy, sz);
+			ax += sx; ay += sy; az += sz;
+		}
+
+	private:
+		template<typename Real>
+		static Real pull(const BasicForceBatch<Real>& b, size_t j, Real distSq)
+		{
+			// Select instead of a branch so the loop vectorizes, also skips i itself
+			return distSq < Real(gravDistSqMin) ? Real(0) : b.mass[j] / (distSq * std::sqrt(distSq));
+		}
+
+		template<typename Real>
+		static void sum(const BasicForceBatch<Real>& b, size_t i, Real& sx, Real& sy, Real& sz)
+		{
+			const Real* const* p = b.pos;
+			const Real xi = p[0][i], yi = p[1][i], zi = p[2][i];
+			// Locals, the output references might alias the positions and keep the loop scalar
+			Real x = 0, y = 0, z = 0;
+			for (size_t j = 0; j < b.n; ++j)
+			{
+				const Real dx = p[0][j] - xi;
+				const Real dy = p[1][j] - yi;
+				const Real dz = p[2][j] - zi;
+				const Real s = pull(b, j, dx * dx + dy * dy + dz * dz);
+				x += dx * s; y += dy * s; z += dz * s;
+			}
+			sx = x; sy = y; sz = z;
+		}
+
+		template<typename Real>
+		static void sumCompensated(const BasicForceBatch<Real>& b, size_t i, Real& sx, Real& sy, Real& sz)
+		{
+			const Real* const* p = b.pos;
+			const Real xi = p[0][i], yi = p[1][i], zi = p[2][i];
+			CompensatedSum<Real> x, y, z;
+			for (size_t j = 0; j < b.n; ++j)
+			{
+				const Real dx = p[0][j] - xi;
+				const Real dy = p[1][j] - yi;
+				const Real dz = p[2][j] - zi;
+				const Real s = pull(b, j, dx * dx + dy * dy + dz * dz);
+				x.add(dx * s); y.add(dy * s); z.add(dz * s);
+			}
+			sx = x.value(); sy = y.value(); sz = z.value();
+		}
+	};
+
+	// Limits the acceleration summed so far to maxAcceleration, put it right
+	// after a batch gravity term to clamp the gravity alone
+	struct AccelerationLimit
+	{
+		template<typename Real>
+		void accumulate(const BasicForceBatch<Real>&, size_t, Real& ax, Real& ay, Real& az) const
+		{
+			clampAcceleration(ax, ay, az);
+		}
+	};
+
+	// Spring back into a sphere around the origin, damped along the normal
+	struct BoundingSphere
+	{
+		float radius;
+		float damping = 0.5f;
+
+		template<typename Real>
+		void accumulate(const BasicForceBatch<Real>& b, size_t i, Real& ax, Real& ay, Real& az) const
+		{
+			const Real* const* p = b.pos;
+			const Real* const* v = b.vel;
+			const Real dist = std::sqrt(p[0][i] * p[0][i] + p[1][i] * p[1][i] + p[2][i] * p[2][i]);
+			if (dist <= radius)
+				return;
+			const Real nx = p[0][i] / dist, ny = p[1][i] / dist, nz = p[2][i] / dist;
+			const Real push = (dist - radius) + damping * (v[0][i] * nx + v[1][i] * ny + v[2][i] * nz);
+			ax -= nx * push; ay -= ny * push; az -= nz * push;
+		}
+	};
+
+	// Drag against the velocity, linear (-k v) plus quadratic (-c |v| v), per unit mass
+	struct Drag
+	{
+		float linear;
+		float quadratic = 0;
+
+		template<typename Real>
+		void accumulate(const BasicForceBatch<Real>& b, size_t i, Real& ax, Real& ay, Real& az) const
+		{
+			const Real* const* v = b.vel;
+			const Real speed = std::sqrt(v[0][i] * v[0][i] + v[1][i] * v[1][i] + v[2][i] * v[2][i]);
+			const Real k = linear + quadratic * speed;
+			ax -= k * v[0][i]; ay -= k * v[1][i]; az -= k * v[2][i];
+		}
+	};
+
+	template<typename... Terms>
+	class ForceSet
+	{
+		static_assert(((BatchForceTerm<Terms> || BodyForceTerm<Terms>) && ...), "Force terms need compute(batch, a) or accumulate(batch, i, ax, ay, az)");
+		static_assert((BatchForceTerm<Terms> + ... + 0) <= 1, "A force set can have one batch term, the others add up per body");
+
+	public:
+		explicit ForceSet(Terms... terms)
+			:
+			terms(std::move(terms)...)
+		{
+		}
+
+		// Body terms for body i, on top of whatever is in ax, ay, az
+		template<typename Real>
+		void accumulate(const BasicForceBatch<Real>& b, size_t i, Real& ax, Real& ay, Real& az) const
+		{
+			std::apply([&](const Terms&... term)
+				{
+					(accumulateTerm(term, b, i, ax, ay, az), ...);
+				}, terms);
+		}
+
+		// Accelerations of the batch: the batch term fills a, then one pass adds the body terms
+		template<typename Real>
+		void evaluate(const BasicForceBatch<Real>& b, Real* const a[3]) const
+		{
+			constexpr bool hasBatchTerm = (BatchForceTerm<Terms> || ...);
+			if constexpr (hasBatchTerm)
+			{
+				std::apply([&](const Terms&... term)
+					{
+						(computeTerm(term, b, a), ...);
+					}, terms);
+			}
+			if constexpr ((BodyForceTerm<Terms> || ...))
+			{
+				parallelFor(b.count, grain, [&](size_t begin, size_t end)
+					{
+						for (size_t k = begin; k < end; ++k)
+						{
+							Real ax = 0, ay = 0, az = 0;
+							if constexpr (hasBatchTerm)
+							{
+								ax = a[0][k]; ay = a[1][k]; az = a[2][k];
+							}
+							accumulate(b, b.index(k), ax, ay, az);
+							a[0][k] = ax; a[1][k] = ay; a[2][k] = az;
+						}
+					});
+			}
+		}
+
+	private:
+		template<typename Term, typename Real>
+		static void computeTerm(const Term& term, const BasicForceBatch<Real>& b, Real* const a[3])
+		{
+			if constexpr (BatchForceTerm<Term>)
+				term.compute(b, a);
+		}
+
+		template<typename Term, typename Real>
+		static void accumulateTerm(const Term& term, const BasicForceBatch<Real>& b, size_t i, Real& ax, Real& ay, Real& az)
+		{
+			if constexpr (BodyForceTerm<Term>)
+				term.accumulate(b, i, ax, ay, az);
+		}
+
+	private:
+		static constexpr size_t grain = 256;
+
+	private:
+		std::tuple<Terms...> terms;
+	};
+
+	// An integration method of Integrators.h bound to a set of forces at compile time
+	template<typename Method, typename Forces>
+	struct Integrator
+	{
+		template<typename Real>
+		static void step(Real* const pos[3], Real* const vel[3], const float* mass, size_t n, float dt,
+			ScratchArena& scratch, BasicAccelerationCache<Real>& cache, const Forces& forces)
+		{
+			Method::step(pos, vel, mass, n, dt, scratch, cache, [&](const Real* const p[3], const Real* const v[3], Real* const a[3])
+				{
+					forces.evaluate(BasicForceBatch<Real>(n, p, v, mass), a);
+				});
+		}
+	};
+
+	// Time of the same RK4 steps with the forces called through std::function and
+	// virtual terms (the way the forces used to be called) and through Integrator<RK4, ForceSet>
+	struct ForceDispatchComparison
+	{
+		const char* forces = "";
+		int steps = 0;
+		double typeErasedSeconds = 0;
+		double fusedSeconds = 0;
+		float maxDifference = 0; // largest position difference between the two
+	};
+
+	// Compares gravity with the bounding sphere, where the O(n) gravity sum per body hides
+	// the call overhead, and the bounding sphere alone, where the overhead is most of the work
+	std::vector<ForceDispatchComparison> compareForceDispatch(const std::vector<State>& states,
+		const std::vector<float>& masses,
+		float G, float boundingSphereSize, int steps = 20);
+
+	// Time of the same RK4 steps with the pairwise direct sum in the fast and in the
+	// deterministic mode, and whether each ends up where a single thread does
+	struct DeterminismComparison
+	{
+		int steps = 0;
+		size_t threads = 0; // of the shared pool
+		double fastSeconds = 0;
+		double deterministicSeconds = 0;
+		bool fastMatchesSingleThread = false;
+		bool deterministicMatchesSingleThread = false;
+	};
+
+	DeterminismComparison compareDeterminism(const std::vector<State>& states,
+		const std::vector<float>& masses,
+		float G, int steps = 20);
+}
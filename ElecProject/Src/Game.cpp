@@ -1,15 +1,27 @@
 #include "Game.h"
 #include <numbers>
-#include "PhysEngine.h"
 #include "ImGuiCustom.h"
 #include "Ray.h"
 #include "Logger.h"
 #include <d3dcompiler.h>
+#include <algorithm>
+#include <cmath>
 #include <random>
+#include <chrono>
+#include <stdexcept>
 
 namespace dx = DirectX;
 using namespace Microsoft::WRL;
 
+namespace
+{
+	// Two planets orbiting each other
+	constexpr const char* defaultScenario = R"(
+		body pos=0,0,0 vel=0,0,5 mass=1e3 radius=16 seed=-1
+		body pos=100,0,0 vel=0,6,-6 mass=1 radius=7 seed=0.5
+	)";
+}
+
 Game::Game()
 	: wnd(ScreenWidth, ScreenHeight, WindowTitle)
 	, gfx(wnd.GFX())
@@ -22,17 +34,15 @@ Game::Game()
 		FarClipping) // far clipping)
 	);
 
-	// Add planets
-	pPlanets.emplace_back(std::make_unique<Planet>(gfx, -1.f, dx::XMFLOAT3{ 0,0,0 }, 16.f));
-	pPlanets.emplace_back(std::make_unique<Planet>(gfx, 0.5f, dx::XMFLOAT3{ 100,0,0 }, 7.0f));
-
-	pPlanets[0]->SetVelocity({ 0, 0, 5.f });
-	pPlanets[1]->SetVelocity({ 0, 6.f, -6.f });
+	// Start with the default scene, the same format as the scenario files
+	phys::Scenario scenario;
+	std::string error;
+	if (!scenario.parse(defaultScenario, error))
+		throw std::runtime_error("Default scenario: " + error);
+	LoadScenario(scenario);
 
-	pPlanets[0]->SetMass(1e3);
-	pPlanets[1]->SetMass(1);
-
-	Logger::Get().OpenFile("output.csv");
+	[[maybe_unused]] const bool logOpen = Logger::Get().OpenFile("output.csv");
+	assert(logOpen && "Failed to open file");
 }
 
 Game::~Game()
@@ -43,6 +53,7 @@ void Game::Go()
 {
 	dt = ft.Mark(); // Track frame time 
 	gfx.BeginFrame();
+	SyncPlanets();
 	UpdateLogic();
 	DrawFrame();
 
@@ -56,9 +67,6 @@ void Game::UpdateLogic()
 {
 	ControlCamera();
 
-	if (isPhysicsEnabled)
-		testPhys2();
-
 	// Move planets
 	if (controllingPlanet)
 	{
@@ -162,10 +170,231 @@ void Game::HandleKeyboardInput()
 void Game::SpawnControlWindow()
 {
 	ImGui::Begin("Game control", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+	// Settings only go to the simulation thread when one of them changed
+	bool settingsChanged = false;
+	const phys::Simulation::Stats& stats = snapshot->stats;
 	ImGui::TextColored({ 0.5f,0.1f,0,1 }, "There are %d planets", pPlanets.size());
-	ImGui::InputFloat("G", &Gravitational_Const, 0.0f, 0.0f, "%e");
-	ImGui::Checkbox("Physics", &isPhysicsEnabled);
-	ImGui::InputFloat("Bounding Sphere Radius", &boundingSphereSize);
+	settingsChanged |= ImGui::InputFloat("G", &settings.G, 0.0f, 0.0f, "%e");
+	if (ImGui::Checkbox("Physics", &isPhysicsEnabled))
+		simulation.setEnabled(isPhysicsEnabled);
+	if (ImGui::Checkbox("Fixed Time Step", &useFixedTimestep))
+		simulation.setFixedTimestep(useFixedTimestep);
+	if (useFixedTimestep)
+	{
+		if (ImGui::InputFloat("Physics Rate (Hz)", &physicsRate) && physicsRate > 0)
+			simulation.setRate(physicsRate);
+		if (ImGui::InputInt("Max Steps Per Wake", &maxSubsteps))
+			simulation.setMaxSubsteps(maxSubsteps);
+	}
+	ImGui::Text("Simulated %.2f s, %.2f s dropped", snapshot->simulatedTime, snapshot->droppedTime);
+	ImGui::Text("Heap allocations in last step: %zu", stats.allocations);
+	const char* boundaryNames[] = { "Bounding sphere", "Reflective box", "Periodic box", "None" };
+	int boundaryIdx = (int)settings.boundary;
+	if (ImGui::Combo("Boundary", &boundaryIdx, boundaryNames, IM_ARRAYSIZE(boundaryNames)))
+	{
+		settings.boundary = (phys::Simulation::Boundary)boundaryIdx;
+		settingsChanged = true;
+	}
+	settingsChanged |= ImGui::InputFloat("Boundary Radius / Half Width", &settings.boundarySize);
+	if (settings.boundary == phys::Simulation::Boundary::ReflectiveBox)
+		settingsChanged |= ImGui::SliderFloat("Wall Restitution", &settings.wallRestitution, 0.f, 1.f);
+	settingsChanged |= ImGui::InputFloat("Drag", &settings.drag);
+
+	// Gravity solver selection
+	const char* simdNames[] = { "Scalar", "AVX2", "AVX-512" };
+	int simd = (int)phys::getSimdLevel();
+	if (ImGui::Combo("Force Kernel", &simd, simdNames, (int)phys::detectSimdLevel() + 1))
+		phys::setSimdLevel((phys::SimdLevel)simd);
+	const char* solverNames[] = { "Direct sum", "Barnes-Hut", "FMM" };
+	int solver = (int)settings.gravitySolver;
+	if (ImGui::Combo("Gravity Solver", &solver, solverNames, IM_ARRAYSIZE(solverNames)))
+	{
+		settings.gravitySolver = (phys::Simulation::GravitySolver)solver;
+		settingsChanged = true;
+	}
+	const char* integratorNames[] = { "RK4", "Leapfrog (KDK)", "Velocity Verlet", "Yoshida 4th order", "Dormand-Prince 5(4)", "Block time steps" };
+	int integratorIdx = (int)settings.integrator;
+	if (ImGui::Combo("Integrator", &integratorIdx, integratorNames, IM_ARRAYSIZE(integratorNames)))
+	{
+		settings.integrator = (phys::Simulation::Integrator)integratorIdx;
+		settingsChanged = true;
+	}
+	const char* precisionNames[] = { "Float", "Double", "Mixed (double state, float forces)" };
+	int precisionIdx = (int)settings.precision;
+	if (ImGui::Combo("Precision", &precisionIdx, precisionNames, IM_ARRAYSIZE(precisionNames)))
+	{
+		settings.precision = (phys::Simulation::Precision)precisionIdx;
+		settingsChanged = true;
+	}
+	if (settings.precision == phys::Simulation::Precision::Double)
+		ImGui::Text("Gravity is summed directly in double, the solver is ignored");
+	const char* collisionNames[] = { "None", "Merge", "Elastic" };
+	int collisionIdx = (int)settings.collisionResponse;
+	if (ImGui::Combo("Collisions", &collisionIdx, collisionNames, IM_ARRAYSIZE(collisionNames)))
+	{
+		settings.collisionResponse = (phys::Simulation::CollisionResponse)collisionIdx;
+		settingsChanged = true;
+	}
+	if (settings.collisionResponse == phys::Simulation::CollisionResponse::Elastic)
+		settingsChanged |= ImGui::SliderFloat("Restitution", &settings.restitution, 0.f, 1.f);
+	if (settings.collisionResponse != phys::Simulation::CollisionResponse::None)
+	{
+		const auto& collisionStats = stats.collisions;
+		ImGui::Text("%zu candidate pairs, %zu contacts, %zu merged", collisionStats.candidatePairs, collisionStats.contacts, collisionStats.merged);
+	}
+	if (settings.integrator == phys::Simulation::Integrator::DormandPrince45)
+	{
+		float relTol = settings.relTolerance;
+		float absTol = settings.absTolerance;
+		if (ImGui::InputFloat("Relative Tolerance", &relTol, 0.0f, 0.0f, "%e") && relTol > 0)
+		{
+			settings.relTolerance = relTol;
+			settingsChanged = true;
+		}
+		if (ImGui::InputFloat("Absolute Tolerance", &absTol, 0.0f, 0.0f, "%e") && absTol > 0)
+		{
+			settings.absTolerance = absTol;
+			settingsChanged = true;
+		}
+		const auto& dpStats = stats.dormandPrince;
+		ImGui::Text("%zu steps (%zu rejected, %zu forced), last dt %.3e", dpStats.accepted, dpStats.rejected, dpStats.forced, dpStats.lastStep);
+	}
+	if (settings.integrator == phys::Simulation::Integrator::BlockTimesteps)
+	{
+		float accuracy = settings.blockAccuracy;
+		if (ImGui::InputFloat("Step Accuracy", &accuracy, 0.0f, 0.0f, "%e") && accuracy > 0)
+		{
+			settings.blockAccuracy = accuracy;
+			settingsChanged = true;
+		}
+		const auto& blockStats = stats.blockTimesteps;
+		const double sharedStep = (double)pPlanets.size() * ((size_t)1 << blockStats.deepestLevel);
+		ImGui::Text("Deepest level %d, %zu force evaluations (%.1f%% of a shared step)",
+			blockStats.deepestLevel, blockStats.forceEvaluations, sharedStep > 0 ? 100.0 * blockStats.forceEvaluations / sharedStep : 0.0);
+	}
+	if (settings.gravitySolver == phys::Simulation::GravitySolver::Direct)
+	{
+		settingsChanged |= ImGui::Checkbox("Pairwise (Newton's third law)", &settings.gravityPairwise);
+		if (settings.gravityPairwise)
+			settingsChanged |= ImGui::Checkbox("Deterministic (same result on any thread count)", &settings.deterministic);
+		ImGui::Text("%.3g interactions/s", stats.interactionsPerSec);
+	}
+	if (settings.gravitySolver == phys::Simulation::GravitySolver::BarnesHut)
+	{
+		settingsChanged |= ImGui::SliderFloat("Opening Angle", &settings.barnesHutTheta, 0.1f, 1.5f);
+		settingsChanged |= ImGui::Checkbox("Quadrupole", &settings.barnesHutQuadrupole);
+	}
+	if (settings.gravitySolver == phys::Simulation::GravitySolver::Fmm)
+	{
+		settingsChanged |= ImGui::SliderInt("Expansion Order", &settings.fmmOrder, 1, phys::FmmSolver::MaxOrder);
+		settingsChanged |= ImGui::SliderFloat("FMM Opening Angle", &settings.fmmTheta, 0.1f, 1.0f);
+		if (ImGui::Button("Compare with direct sum"))
+		{
+			std::vector<phys::State> states;
+			std::vector<float> masses;
+			GatherPlanetStates(states, masses);
+			fmmComparison = phys::compareFmmWithDirect(states, masses, settings.G, settings.fmmTheta, phys::FmmSolver::MaxOrder);
+		}
+		if (!fmmComparison.empty() && ImGui::BeginTable("FMM comparison", 4))
+		{
+			ImGui::TableSetupColumn("Order");
+			ImGui::TableSetupColumn("RMS error");
+			ImGui::TableSetupColumn("Max error");
+			ImGui::TableSetupColumn("Speedup");
+			ImGui::TableHeadersRow();
+			for (const auto& r : fmmComparison)
+			{
+				ImGui::TableNextRow();
+				ImGui::TableNextColumn(); ImGui::Text("%d", r.order);
+				ImGui::TableNextColumn(); ImGui::Text("%.2e", r.rmsRelError);
+				ImGui::TableNextColumn(); ImGui::Text("%.2e", r.maxRelError);
+				ImGui::TableNextColumn(); ImGui::Text("%.1fx", r.directSeconds / r.fmmSeconds);
+			}
+			ImGui::EndTable();
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Force Dispatch Benchmark"))
+	{
+		// RK4 steps on the current planets with type erased and with fused forces
+		if (ImGui::Button("Run benchmark"))
+		{
+			std::vector<phys::State> states;
+			std::vector<float> masses;
+			GatherPlanetStates(states, masses);
+			forceDispatchComparison = phys::compareForceDispatch(states, masses, settings.G, settings.boundarySize);
+		}
+		if (!forceDispatchComparison.empty() && ImGui::BeginTable("Force dispatch", 4))
+		{
+			ImGui::TableSetupColumn("Forces");
+			ImGui::TableSetupColumn("std::function (ms/step)");
+			ImGui::TableSetupColumn("ForceSet (ms/step)");
+			ImGui::TableSetupColumn("Speedup");
+			ImGui::TableHeadersRow();
+			for (const auto& r : forceDispatchComparison)
+			{
+				ImGui::TableNextRow();
+				ImGui::TableNextColumn(); ImGui::Text("%s", r.forces);
+				ImGui::TableNextColumn(); ImGui::Text("%.3f", 1e3 * r.typeErasedSeconds / r.steps);
+				ImGui::TableNextColumn(); ImGui::Text("%.3f", 1e3 * r.fusedSeconds / r.steps);
+				ImGui::TableNextColumn(); ImGui::Text("%.2fx", r.typeErasedSeconds / r.fusedSeconds);
+			}
+			ImGui::EndTable();
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Determinism Benchmark"))
+	{
+		// RK4 steps on the current planets with the pairwise sum in both modes
+		if (ImGui::Button("Run determinism benchmark"))
+		{
+			std::vector<phys::State> states;
+			std::vector<float> masses;
+			GatherPlanetStates(states, masses);
+			determinismComparison = phys::compareDeterminism(states, masses, settings.G);
+		}
+		const auto& r = determinismComparison;
+		if (r.steps > 0)
+		{
+			ImGui::Text("Fast: %.3f ms/step, %s 1 thread", 1e3 * r.fastSeconds / r.steps,
+				r.fastMatchesSingleThread ? "same as" : "differs from");
+			ImGui::Text("Deterministic: %.3f ms/step, %s 1 thread", 1e3 * r.deterministicSeconds / r.steps,
+				r.deterministicMatchesSingleThread ? "same as" : "differs from");
+			ImGui::Text("Overhead on %zu threads: %.1f%%", r.threads, 100.0 * (r.deterministicSeconds / r.fastSeconds - 1.0));
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Conserved Quantities"))
+	{
+		settingsChanged |= ImGui::Checkbox("Measure every step", &settings.measureDiagnostics);
+		settingsChanged |= ImGui::Checkbox("Exact potential (as costly as a force evaluation)", &settings.exactPotential);
+		const phys::Diagnostics& diag = stats.diagnostics;
+		if (!hasReferenceEnergy || ImGui::Button("Reset energy reference"))
+		{
+			referenceEnergy = diag.totalEnergy();
+			hasReferenceEnergy = diag.mass > 0;
+		}
+		const double drift = referenceEnergy != 0 ? (diag.totalEnergy() - referenceEnergy) / std::abs(referenceEnergy) : 0.0;
+		ImGui::Text("Energy %.6e (kinetic %.6e, potential %.6e%s)", diag.totalEnergy(), diag.kineticEnergy, diag.potentialEnergy, diag.potentialExact ? "" : ", sampled");
+		ImGui::Text("Energy drift %.3e", drift);
+		ImGui::Text("Momentum (%.4e, %.4e, %.4e)", diag.momentum[0], diag.momentum[1], diag.momentum[2]);
+		ImGui::Text("Angular momentum (%.4e, %.4e, %.4e)", diag.angularMomentum[0], diag.angularMomentum[1], diag.angularMomentum[2]);
+		ImGui::Text("Center of mass (%.3f, %.3f, %.3f)", diag.centerOfMass[0], diag.centerOfMass[1], diag.centerOfMass[2]);
+		ImGui::Text("Measured in %.3f ms", 1e3f * diag.seconds);
+		if (ImGui::Checkbox("Log Conserved Quantities", &isLoggingDiagnostics) && isLoggingDiagnostics)
+		{
+			Logger::Get().LogHeader("energy", "kinetic", "potential", "momentum.x", "momentum.y", "momentum.z",
+				"angular.x", "angular.y", "angular.z");
+		}
+	}
+	// Keeps logging with the header closed
+	if (isLoggingDiagnostics)
+	{
+		const phys::Diagnostics& diag = stats.diagnostics;
+		Logger::Get().LogWithTime(diag.totalEnergy(), diag.kineticEnergy, diag.potentialEnergy,
+			diag.momentum[0], diag.momentum[1], diag.momentum[2],
+			diag.angularMomentum[0], diag.angularMomentum[1], diag.angularMomentum[2]);
+	}
 
 	if (ImGui::CollapsingHeader("New Planet"))
 	{
@@ -178,7 +407,8 @@ void Game::SpawnControlWindow()
 			auto midRay = RayUtils::fromNDC(0, 0, gfx.GetCamera().GetInvMatrix(), gfx.GetInvProjection());
 			float newPlanetDistAway = newPlanetRadius * 2.f;
 			auto newPlanetPos = dx::XMVectorAdd(midRay.origin, dx::XMVectorScale(midRay.direction, newPlanetDistAway));
-			pPlanets.emplace_back(std::make_unique<Planet>(gfx, (float)rand(), dx::XMFLOAT3{ 0,0,0 }, newPlanetRadius));
+			std::uniform_real_distribution<float> terrain(-150.f, 150.f);
+			pPlanets.emplace_back(std::make_unique<Planet>(gfx, simulation, terrain(terrainRng), dx::XMFLOAT3{ 0,0,0 }, newPlanetRadius));
 			pPlanets.back()->SetVecPosition(newPlanetPos);
 			pPlanets.back()->SetMass(newPlanetMass);
 		}
@@ -199,17 +429,82 @@ void Game::SpawnControlWindow()
 			CreatePlanetGrid(planetGridRadius, planetGridSpacing, planetGridMass);
 		}
 	}
+
+	if (ImGui::CollapsingHeader("Scenario"))
+	{
+		static char scenarioPath[256] = "scenario.txt";
+		ImGui::InputText("Scenario File", scenarioPath, sizeof(scenarioPath));
+		if (ImGui::Button("Load Scenario"))
+		{
+			phys::Scenario scenario;
+			if (scenario.load(scenarioPath, scenarioStatus))
+			{
+				LoadScenario(scenario);
+				scenarioStatus = "Loaded " + std::to_string(pPlanets.size()) + " bodies from " + scenarioPath;
+				// The scenario's settings went to the simulation already
+				settingsChanged = false;
+			}
+		}
+		if (!scenarioStatus.empty())
+			ImGui::Text("%s", scenarioStatus.c_str());
+	}
+
+	if (ImGui::CollapsingHeader("Checkpoint"))
+	{
+		static char checkpointPath[256] = "checkpoint.bin";
+		ImGui::InputText("File", checkpointPath, sizeof(checkpointPath));
+		// Written from a copy of the snapshot on the writer's thread
+		if (ImGui::Button("Save") && !checkpointWriter.save(checkpointPath, *snapshot, settings))
+			checkpointStatus = "Still saving the last checkpoint";
+		ImGui::SameLine();
+		if (ImGui::Button("Load"))
+		{
+			LoadCheckpoint(checkpointPath);
+			// The loaded settings went to the simulation already
+			settingsChanged = false;
+		}
+		if (checkpointWriter.isSaving())
+			ImGui::Text("Saving...");
+		else if (!checkpointWriter.getStatus().empty())
+			ImGui::Text("%s", checkpointWriter.getStatus().c_str());
+		if (!checkpointStatus.empty())
+			ImGui::Text("%s", checkpointStatus.c_str());
+	}
+
+	if (settingsChanged)
+		simulation.setSettings(settings);
 	
 	ImGui::End();
 }
 
 void Game::DrawFrame()
 {
-	// Draw each planet
+	// Draw each planet moving across the snapshot's step, one step behind the
+	// simulation, unless it was changed here since (or is being dragged around)
+	float alpha = 1.f;
+	if (snapshot->step > 0)
+	{
+		const std::chrono::duration<float> sincePublish = std::chrono::steady_clock::now() - snapshot->time;
+		alpha = std::clamp(sincePublish.count() / snapshot->step, 0.f, 1.f);
+	}
 	for (auto& p : pPlanets)
 	{
-		p->Draw(gfx);
-	}	
+		if (p->Sync(*snapshot) && p.get() != controlledPlanet)
+		{
+			const size_t i = snapshot->indexOf(p->GetBodyId());
+			const float* previous = &snapshot->previousPositions[3 * i];
+			const phys::Body& body = snapshot->bodies[i];
+			const dx::XMFLOAT3 renderPos = {
+				previous[0] + (body.x - previous[0]) * alpha,
+				previous[1] + (body.y - previous[1]) * alpha,
+				previous[2] + (body.z - previous[2]) * alpha };
+			p->DrawAt(gfx, renderPos);
+		}
+		else
+		{
+			p->Draw(gfx);
+		}
+	}
 	wnd.GFX().GetCamera().spawnControlWindow();
 	//ImGui::ShowDemoWindow();
 
@@ -220,109 +515,84 @@ void Game::DrawFrame()
 	//ImGui::End();
 }
 
-void Game::testPhys2()
+void Game::LoadCheckpoint(const std::string& path)
 {
-	auto getPlanetState = [](const Planet& p) -> phys::State
-		{
-			phys::State ret;
-			ret.position = p.GetVecPosition();
-			ret.velocity = p.GetVecVelocity();
-			return ret;
-		};
+	phys::CheckpointFile file;
+	if (!file.open(path, checkpointStatus))
+		return;
 
-	size_t numPlanets = pPlanets.size();
+	ClearPlanets();
+	settings.G = file.getG();
+	settings.boundary = file.getBoundary();
+	settings.boundarySize = file.getBoundarySize();
+	simulation.setSettings(settings);
+	simulation.setSimulatedTime((float)file.getSimulatedTime());
+
+	pPlanets.reserve(file.size());
+	for (size_t i = 0; i < file.size(); ++i)
+		pPlanets.emplace_back(std::make_unique<Planet>(gfx, simulation, file.getBody(i)));
+	hasReferenceEnergy = false;
+	checkpointStatus = "Loaded " + std::to_string(file.size()) + " bodies from " + path;
+}
 
-	// Create vectors to hold the states and masses of all planets (super efficient)
-	std::vector<phys::State> planetStates(numPlanets);
-	std::vector<float> planetMasses(numPlanets);
+void Game::LoadScenario(const phys::Scenario& scenario)
+{
+	ClearPlanets();
+	settings = scenario.settings;
+	simulation.setSettings(settings);
+	simulation.setSimulatedTime(0.f);
+	physicsRate = 1.f / scenario.dt;
+	simulation.setRate(physicsRate);
+	terrainRng.seed((std::mt19937::result_type)scenario.seed);
+
+	// Generated in parallel into a store of its own, then handed out one planet per body
+	phys::BodyStore bodies;
+	scenario.generate(bodies);
+	pPlanets.reserve(bodies.size());
+	for (size_t i = 0; i < bodies.size(); ++i)
+		pPlanets.emplace_back(std::make_unique<Planet>(gfx, simulation, bodies.get(i)));
+	hasReferenceEnergy = false;
+}
 
-	// Get all masses
-	for (size_t i = 0; i < numPlanets; ++i)
+void Game::ClearPlanets()
+{
+	controllingPlanet = false;
+	controlledPlanet = nullptr;
+	pPlanets.clear();
+}
+
+void Game::GatherPlanetStates(std::vector<phys::State>& states, std::vector<float>& masses) const
+{
+	states.resize(pPlanets.size());
+	masses.resize(pPlanets.size());
+	for (size_t i = 0; i < pPlanets.size(); ++i)
 	{
-		planetStates[i] = getPlanetState(*pPlanets[i]);
-		planetMasses[i] = pPlanets[i]->GetMass();
+		states[i].position = pPlanets[i]->GetVecPosition();
+		states[i].velocity = pPlanets[i]->GetVecVelocity();
+		masses[i] = pPlanets[i]->GetMass();
 	}
+}
 
-	// Copy OG states 
-	std::vector<phys::State> originalStates = planetStates;
-
-	// For each planet, compute the acceleration due to other planets and integrate
-	for (size_t i = 0; i < numPlanets; ++i)
-	{
-		// make vectors of other planets' states and masses
-		std::vector<phys::State> otherStates;
-		std::vector<float> otherMasses;
+void Game::SyncPlanets()
+{
+	// Planets changed by the UI keep their own state until the simulation caught up
+	snapshot = &simulation.latest();
+	for (auto& p : pPlanets)
+		p->Sync(*snapshot);
 
-		for (size_t j = 0; j < numPlanets; ++j)
+	// Planets merged into others are gone from the simulation, let go of them too
+	const auto gone = std::remove_if(pPlanets.begin(), pPlanets.end(), [this](const std::unique_ptr<Planet>& p)
 		{
-			if (j != i)
+			if (!p->IsGone(*snapshot))
+				return false;
+			if (p.get() == controlledPlanet)
 			{
-				otherStates.push_back(originalStates[j]);
-				otherMasses.push_back(planetMasses[j]);
+				controllingPlanet = false;
+				controlledPlanet = nullptr;
 			}
-		}
-
-		// Gravitational force computation for planet i
-		phys::GravForce agf(otherStates, otherMasses, Gravitational_Const, planetMasses[i]);
-
-		// Acceleration lambda for integration
-		auto computeAccel = [&](const phys::State& s)
-			{
-				DirectX::XMVECTOR forceV = agf.compute(s);
-				auto accelV = dx::XMVectorScale(forceV, 1.0f / planetMasses[i]);
-				// Clamp Acceleration
-				constexpr const float maxAccel = 1e6;
-				float magAccel = dx::XMVectorGetX(dx::XMVector3LengthEst(accelV));
-				if (magAccel > maxAccel)
-				{
-					auto normAccel = dx::XMVector3Normalize(accelV);
-					accelV = dx::XMVectorScale(normAccel, maxAccel);
-				}
-				return accelV;
-			};
-		// Acceleration lambda alt integration
-		auto computeAccelBox = [&](const phys::State& s)
-			{
-				DirectX::XMVECTOR accel = dx::XMVectorZero();
-				
-
-				// Compute the distance from the origin to the object
-				float dist;
-				dx::XMStoreFloat(&dist, dx::XMVector3Length(s.position));
-
-				if (dist > boundingSphereSize)
-				{
-					// Calculate the penetration depth
-					float penetrationDepth = dist - boundingSphereSize;
-
-					// Compute the normal vector pointing towards the center of the sphere
-					DirectX::XMVECTOR normal = dx::XMVector3Normalize(s.position);
-
-					// Apply an acceleration proportional to the penetration depth
-					// Negative sign to push the object back inside the sphere
-					accel = dx::XMVectorScale(normal, -penetrationDepth);
-
-					// add damping to prevent oscillations
-					const float dampingFactor = 0.5f;
-					DirectX::XMVECTOR velocityAlongNormal = dx::XMVectorScale(normal, dx::XMVectorGetX(dx::XMVector3Dot(s.velocity, normal)));
-					accel = dx::XMVectorSubtract(accel, dx::XMVectorScale(velocityAlongNormal, dampingFactor));
-				}
-
-				return accel;
-			};
-
-		// Integrate the state of planet i
-		rk4Integrate(planetStates[i], dt, computeAccel);
-		// Integrate for the bounding "box"
-		rk4Integrate(planetStates[i], dt, computeAccelBox);
-	}
-
-	// Update the planets with their new positions and velocities
-	for (size_t i = 0; i < numPlanets; ++i)
-	{
-		pPlanets[i]->SetVecPosition(planetStates[i].position);
-		pPlanets[i]->SetVecVelocity(planetStates[i].velocity);
-	}
+			return true;
+		});
+	pPlanets.erase(gone, pPlanets.end());
 }
 
 std::optional<std::reference_wrapper<Planet>> Game::DetectPlanetIntersection(float ndcX, float ndcY)
@@ -425,12 +695,11 @@ void Game::AttachPlanetToCursor()
 void Game::CreatePlanetGrid(float radius, float spacing, float planetMass)
 {
 	constexpr float r2o2 = 0.70710678f; // sqrt(2)/2 for bounding sphere diagonal estimation
-	static std::mt19937 rng(std::random_device{}());
 	std::uniform_real_distribution<float> udist(-150.f, 150.f);
 
 	// Compute the maximum number of planets along one axis
 	float cellSize = 2 * radius + spacing;
-	size_t nX = static_cast<size_t>(boundingSphereSize * r2o2 * 2 / cellSize);
+	size_t nX = static_cast<size_t>(settings.boundarySize * r2o2 * 2 / cellSize);
 
 	for (size_t xi = 0; xi < nX; ++xi)
 	{
@@ -439,18 +708,19 @@ void Game::CreatePlanetGrid(float radius, float spacing, float planetMass)
 			for (size_t zi = 0; zi < nX; ++zi)
 			{
 				// Calculate position in the grid
-				float xpos = -boundingSphereSize * r2o2 + xi * cellSize;
-				float ypos = -boundingSphereSize * r2o2 + yi * cellSize;
-				float zpos = -boundingSphereSize * r2o2 + zi * cellSize;
+				float xpos = -settings.boundarySize * r2o2 + xi * cellSize;
+				float ypos = -settings.boundarySize * r2o2 + yi * cellSize;
+				float zpos = -settings.boundarySize * r2o2 + zi * cellSize;
 
 				// Check if the position is within the bounding sphere
 				float distSquared = xpos * xpos + ypos * ypos + zpos * zpos;
-				if (distSquared <= boundingSphereSize * boundingSphereSize)
+				if (distSquared <= settings.boundarySize * settings.boundarySize)
 				{
 					// Create the planet if within bounds
 					pPlanets.emplace_back(std::make_unique<Planet>(
 						gfx,
-						udist(rng),
+						simulation,
+						udist(terrainRng),
 						dx::XMFLOAT3{ xpos, ypos, zpos },
 						radius
 					));
@@ -2,8 +2,15 @@
 #include "Window.h"
 #include "FrameTimer.h"
 #include "Planet.h"
+#include "Simulation.h"
+#include "SimulationThread.h"
+#include "FmmSolver.h"
+#include "ForceTerms.h"
+#include "Checkpoint.h"
+#include "Scenario.h"
 #include <functional>
 #include <optional>
+#include <random>
 
 class Game
 {
@@ -28,10 +35,32 @@ private:
 	// This function will create a grid of planets
 	void CreatePlanetGrid(float radius, float spacing, float planetMass);
 
-	// This function will be reworked at some point
-	void testPhys2();
-	float Gravitational_Const = 1e0;
-	float boundingSphereSize = 500.f;
+	// Takes the newest simulation snapshot and brings the planets up to date with it
+	void SyncPlanets();
+	// Replaces every planet and the saved settings with the ones in a checkpoint file
+	void LoadCheckpoint(const std::string& path);
+	// Replaces every planet and the settings with the ones of a scenario
+	void LoadScenario(const phys::Scenario& scenario);
+	// Lets go of every planet, e.g. before loading others
+	void ClearPlanets();
+	// Copies the planets' last known states, for the comparisons that run on the UI thread
+	void GatherPlanetStates(std::vector<phys::State>& states, std::vector<float>& masses) const;
+
+	// Physics settings as shown in the UI, the simulation thread gets a copy when they change
+	phys::Simulation::Settings settings;
+	std::vector<phys::FmmComparison> fmmComparison; // Last accuracy/throughput comparison
+	std::vector<phys::ForceDispatchComparison> forceDispatchComparison; // Last benchmark of the force calls
+	phys::DeterminismComparison determinismComparison; // Last benchmark of the deterministic mode, steps 0 until run
+	double referenceEnergy = 0; // Total energy the drift is measured against
+	bool hasReferenceEnergy = false;
+	bool isLoggingDiagnostics = false;
+	phys::CheckpointWriter checkpointWriter;
+	std::string checkpointStatus; // Outcome of the last load, or of a save that couldn't start
+	std::string scenarioStatus; // Outcome of the last scenario load
+	std::mt19937 terrainRng{ 1 }; // Terrain of the planets added by hand, seeded by the scenario
+	float physicsRate = 120.f; // Hz
+	int maxSubsteps = 8;
+	bool useFixedTimestep = true;
 
 	// If the normalized device coords are on a planet, return that planet
 	// otherwise return an empty optional
@@ -41,7 +70,12 @@ private:
 	Window wnd;
 	Graphics& gfx;
 	FrameTimer ft;
+	// Physics on its own thread, planets are handles into it
+	// (declared first so it outlives the planets)
+	phys::SimulationThread simulation;
 	std::vector<std::unique_ptr<Planet>> pPlanets;
+	// Newest simulation state, taken at the start of the frame
+	const phys::Snapshot* snapshot = nullptr;
 private:
 	float dt = 0;
 	bool controllingPlanet = false;
@@ -0,0 +1,551 @@
+#include "GravityKernels.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define PHYS_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+// MSVC lets every function use any intrinsic
+#define PHYS_TARGET_AVX2
+#define PHYS_TARGET_AVX512
+#else
+// GCC/Clang need to be told which functions may use the wider instruction sets
+#define PHYS_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define PHYS_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+#else
+#define PHYS_X86 0
+#endif
+
+namespace
+{
+	using namespace phys;
+
+	// Plain C++ version, also used for the tails the vector kernels leave over.
+	// Output i is for the target at tx[t] that skips source t, where t is targets[i]
+	// or just i when there is no targets list.
+	void gravityScalar(size_t begin, size_t end,
+		const float* tx, const float* ty, const float* tz, const uint32_t* targets,
+		const float* sx, const float* sy, const float* sz, const float* sm,
+		size_t n, float G,
+		float* ax, float* ay, float* az)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			const size_t t = targets ? targets[i] : i;
+			float accX = 0, accY = 0, accZ = 0;
+			for (size_t j = 0; j < n; ++j)
+			{
+				const float dx = sx[j] - tx[t];
+				const float dy = sy[j] - ty[t];
+				const float dz = sz[j] - tz[t];
+				const float distSq = dx * dx + dy * dy + dz * dz;
+				if (distSq < gravDistSqMin || j == t)
+					continue;
+				const float s = sm[j] / (distSq * std::sqrt(distSq));
+				accX += dx * s;
+				accY += dy * s;
+				accZ += dz * s;
+			}
+			ax[i] = G * accX;
+			ay[i] = G * accY;
+			az[i] = G * accZ;
+		}
+	}
+
+#if PHYS_X86
+	// Processes V vectors of 8 targets against every source. Several independent
+	// accumulators per source keep the FMA units busy instead of waiting on latency.
+	template<int V>
+	PHYS_TARGET_AVX2 void gravityTileAvx2(size_t i0,
+		const float* tx, const float* ty, const float* tz, const uint32_t* targets,
+		const float* sx, const float* sy, const float* sz, const float* sm,
+		size_t n, float G,
+		float* ax, float* ay, float* az)
+	{
+		const __m256 minDistSq = _mm256_set1_ps(gravDistSqMin);
+		const __m256 half = _mm256_set1_ps(0.5f);
+		const __m256 threeHalves = _mm256_set1_ps(1.5f);
+
+		__m256 px[V], py[V], pz[V], accX[V], accY[V], accZ[V];
+		__m256i targetIdx[V];
+		for (int v = 0; v < V; ++v)
+		{
+			const size_t i = i0 + 8 * v;
+			if (targets)
+			{
+				targetIdx[v] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(targets + i));
+				px[v] = _mm256_i32gather_ps(tx, targetIdx[v], 4);
+				py[v] = _mm256_i32gather_ps(ty, targetIdx[v], 4);
+				pz[v] = _mm256_i32gather_ps(tz, targetIdx[v], 4);
+			}
+			else
+			{
+				targetIdx[v] = _mm256_add_epi32(_mm256_set1_epi32((int)i), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+				px[v] = _mm256_loadu_ps(tx + i);
+				py[v] = _mm256_loadu_ps(ty + i);
+				pz[v] = _mm256_loadu_ps(tz + i);
+			}
+			accX[v] = accY[v] = accZ[v] = _mm256_setzero_ps();
+		}
+
+		for (size_t j = 0; j < n; ++j)
+		{
+			const __m256 qx = _mm256_set1_ps(sx[j]);
+			const __m256 qy = _mm256_set1_ps(sy[j]);
+			const __m256 qz = _mm256_set1_ps(sz[j]);
+			const __m256 qm = _mm256_set1_ps(sm[j]);
+			const __m256i sourceIdx = _mm256_set1_epi32((int)j);
+
+			for (int v = 0; v < V; ++v)
+			{
+				const __m256 dx = _mm256_sub_ps(qx, px[v]);
+				const __m256 dy = _mm256_sub_ps(qy, py[v]);
+				const __m256 dz = _mm256_sub_ps(qz, pz[v]);
+				const __m256 distSq = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+
+				// 1/sqrt estimate (12 bits) refined with one Newton step
+				__m256 inv = _mm256_rsqrt_ps(distSq);
+				inv = _mm256_mul_ps(inv, _mm256_fnmadd_ps(_mm256_mul_ps(half, distSq), _mm256_mul_ps(inv, inv), threeHalves));
+
+				// Mask out pairs that are too close and the target itself instead of branching
+				const __m256 isSelf = _mm256_castsi256_ps(_mm256_cmpeq_epi32(targetIdx[v], sourceIdx));
+				const __m256 keep = _mm256_andnot_ps(isSelf, _mm256_cmp_ps(distSq, minDistSq, _CMP_GE_OQ));
+				const __m256 s = _mm256_and_ps(keep, _mm256_mul_ps(_mm256_mul_ps(inv, inv), _mm256_mul_ps(inv, qm)));
+
+				accX[v] = _mm256_fmadd_ps(dx, s, accX[v]);
+				accY[v] = _mm256_fmadd_ps(dy, s, accY[v]);
+				accZ[v] = _mm256_fmadd_ps(dz, s, accZ[v]);
+			}
+		}
+
+		const __m256 g = _mm256_set1_ps(G);
+		for (int v = 0; v < V; ++v)
+		{
+			const size_t i = i0 + 8 * v;
+			_mm256_storeu_ps(ax + i, _mm256_mul_ps(accX[v], g));
+			_mm256_storeu_ps(ay + i, _mm256_mul_ps(accY[v], g));
+			_mm256_storeu_ps(az + i, _mm256_mul_ps(accZ[v], g));
+		}
+	}
+
+	PHYS_TARGET_AVX2 void gravityAvx2(size_t begin, size_t end,
+		const float* tx, const float* ty, const float* tz, const uint32_t* targets,
+		const float* sx, const float* sy, const float* sz, const float* sm,
+		size_t n, float G,
+		float* ax, float* ay, float* az)
+	{
+		size_t i = begin;
+		for (; i + 16 <= end; i += 16)
+			gravityTileAvx2<2>(i, tx, ty, tz, targets, sx, sy, sz, sm, n, G, ax, ay, az);
+		for (; i + 8 <= end; i += 8)
+			gravityTileAvx2<1>(i, tx, ty, tz, targets, sx, sy, sz, sm, n, G, ax, ay, az);
+		gravityScalar(i, end, tx, ty, tz, targets, sx, sy, sz, sm, n, G, ax, ay, az);
+	}
+
+	// Same as the AVX2 tile with 16 targets per vector. The tail is handled
+	// with masked loads and stores so no scalar loop is needed.
+	template<int V>
+	PHYS_TARGET_AVX512 void gravityTileAvx512(size_t i0, size_t count,
+		const float* tx, const float* ty, const float* tz, const uint32_t* targets,
+		const float* sx, const float* sy, const float* sz, const float* sm,
+		size_t n, float G,
+		float* ax, float* ay, float* az)
+	{
+		const __m512 minDistSq = _mm512_set1_ps(gravDistSqMin);
+		const __m512 half = _mm512_set1_ps(0.5f);
+		const __m512 threeHalves = _mm512_set1_ps(1.5f);
+
+		__m512 px[V], py[V], pz[V], accX[V], accY[V], accZ[V];
+		__m512i targetIdx[V];
+		__mmask16 lanes[V];
+		for (int v = 0; v < V; ++v)
+		{
+			const size_t i = i0 + 16 * v;
+			const size_t left = count > 16 * (size_t)v ? count - 16 * v : 0;
+			lanes[v] = left >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << left) - 1);
+			if (targets)
+			{
+				targetIdx[v] = _mm512_maskz_loadu_epi32(lanes[v], targets + i);
+				px[v] = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), lanes[v], targetIdx[v], tx, 4);
+				py[v] = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), lanes[v], targetIdx[v], ty, 4);
+				pz[v] = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), lanes[v], targetIdx[v], tz, 4);
+			}
+			else
+			{
+				targetIdx[v] = _mm512_add_epi32(_mm512_set1_epi32((int)i), _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+				px[v] = _mm512_maskz_loadu_ps(lanes[v], tx + i);
+				py[v] = _mm512_maskz_loadu_ps(lanes[v], ty + i);
+				pz[v] = _mm512_maskz_loadu_ps(lanes[v], tz + i);
+			}
+			accX[v] = accY[v] = accZ[v] = _mm512_setzero_ps();
+		}
+
+		for (size_t j = 0; j < n; ++j)
+		{
+			const __m512 qx = _mm512_set1_ps(sx[j]);
+			const __m512 qy = _mm512_set1_ps(sy[j]);
+			const __m512 qz = _mm512_set1_ps(sz[j]);
+			const __m512 qm = _mm512_set1_ps(sm[j]);
+			const __m512i sourceIdx = _mm512_set1_epi32((int)j);
+
+			for (int v = 0; v < V; ++v)
+			{
+				const __m512 dx = _mm512_sub_ps(qx, px[v]);
+				const __m512 dy = _mm512_sub_ps(qy, py[v]);
+				const __m512 dz = _mm512_sub_ps(qz, pz[v]);
+				const __m512 distSq = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+
+				// 14 bit estimate, one Newton step gets to full float precision
+				__m512 inv = _mm512_maskz_rsqrt14_ps((__mmask16)0xFFFF, distSq);
+				inv = _mm512_mul_ps(inv, _mm512_fnmadd_ps(_mm512_mul_ps(half, distSq), _mm512_mul_ps(inv, inv), threeHalves));
+
+				const __mmask16 keep = _mm512_cmp_ps_mask(distSq, minDistSq, _CMP_GE_OQ)
+					& _mm512_cmpneq_epi32_mask(targetIdx[v], sourceIdx);
+				const __m512 s = _mm512_maskz_mul_ps(keep, _mm512_mul_ps(inv, inv), _mm512_mul_ps(inv, qm));
+
+				accX[v] = _mm512_fmadd_ps(dx, s, accX[v]);
+				accY[v] = _mm512_fmadd_ps(dy, s, accY[v]);
+				accZ[v] = _mm512_fmadd_ps(dz, s, accZ[v]);
+			}
+		}
+
+		const __m512 g = _mm512_set1_ps(G);
+		for (int v = 0; v < V; ++v)
+		{
+			const size_t i = i0 + 16 * v;
+			_mm512_mask_storeu_ps(ax + i, lanes[v], _mm512_mul_ps(accX[v], g));
+			_mm512_mask_storeu_ps(ay + i, lanes[v], _mm512_mul_ps(accY[v], g));
+			_mm512_mask_storeu_ps(az + i, lanes[v], _mm512_mul_ps(accZ[v], g));
+		}
+	}
+
+	PHYS_TARGET_AVX512 void gravityAvx512(size_t begin, size_t end,
+		const float* tx, const float* ty, const float* tz, const uint32_t* targets,
+		const float* sx, const float* sy, const float* sz, const float* sm,
+		size_t n, float G,
+		float* ax, float* ay, float* az)
+	{
+		size_t i = begin;
+		for (; i + 32 <= end; i += 32)
+			gravityTileAvx512<2>(i, 32, tx, ty, tz, targets, sx, sy, sz, sm, n, G, ax, ay, az);
+		for (; i < end; i += 16)
+			gravityTileAvx512<1>(i, end - i, tx, ty, tz, targets, sx, sy, sz, sm, n, G, ax, ay, az);
+	}
+
+	// Body i against the bodies [jBegin, jEnd), the pull of each pair is added to
+	// body i and subtracted from body j. Accelerations are left without the G factor.
+	void pairRowScalar(size_t i, size_t jBegin, size_t jEnd,
+		const float* x, const float* y, const float* z, const float* m,
+		float* ax, float* ay, float* az)
+	{
+		const float xi = x[i], yi = y[i], zi = z[i], mi = m[i];
+		float accX = 0, accY = 0, accZ = 0;
+		for (size_t j = jBegin; j < jEnd; ++j)
+		{
+			const float dx = x[j] - xi;
+			const float dy = y[j] - yi;
+			const float dz = z[j] - zi;
+			const float distSq = dx * dx + dy * dy + dz * dz;
+			if (distSq < gravDistSqMin)
+				continue;
+			const float s = 1.f / (distSq * std::sqrt(distSq));
+			accX += dx * s * m[j];
+			accY += dy * s * m[j];
+			accZ += dz * s * m[j];
+			ax[j] -= dx * s * mi;
+			ay[j] -= dy * s * mi;
+			az[j] -= dz * s * mi;
+		}
+		ax[i] += accX;
+		ay[i] += accY;
+		az[i] += accZ;
+	}
+
+#if PHYS_X86
+	PHYS_TARGET_AVX2 float horizontalSum(__m256 v)
+	{
+		__m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+		s = _mm_hadd_ps(s, s);
+		s = _mm_hadd_ps(s, s);
+		return _mm_cvtss_f32(s);
+	}
+
+	// Same as pairRowScalar with 8 bodies j per vector, the j accelerations
+	// are read, updated and written back as whole vectors
+	PHYS_TARGET_AVX2 void pairRowAvx2(size_t i, size_t jBegin, size_t jEnd,
+		const float* x, const float* y, const float* z, const float* m,
+		float* ax, float* ay, float* az)
+	{
+		const __m256 minDistSq = _mm256_set1_ps(gravDistSqMin);
+		const __m256 half = _mm256_set1_ps(0.5f);
+		const __m256 threeHalves = _mm256_set1_ps(1.5f);
+		const __m256 xi = _mm256_set1_ps(x[i]);
+		const __m256 yi = _mm256_set1_ps(y[i]);
+		const __m256 zi = _mm256_set1_ps(z[i]);
+		const __m256 mi = _mm256_set1_ps(m[i]);
+		__m256 accX = _mm256_setzero_ps(), accY = _mm256_setzero_ps(), accZ = _mm256_setzero_ps();
+
+		size_t j = jBegin;
+		for (; j + 8 <= jEnd; j += 8)
+		{
+			const __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(x + j), xi);
+			const __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(y + j), yi);
+			const __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(z + j), zi);
+			const __m256 distSq = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+
+			__m256 inv = _mm256_rsqrt_ps(distSq);
+			inv = _mm256_mul_ps(inv, _mm256_fnmadd_ps(_mm256_mul_ps(half, distSq), _mm256_mul_ps(inv, inv), threeHalves));
+			const __m256 keep = _mm256_cmp_ps(distSq, minDistSq, _CMP_GE_OQ);
+			const __m256 s = _mm256_and_ps(keep, _mm256_mul_ps(_mm256_mul_ps(inv, inv), inv));
+
+			const __m256 sj = _mm256_mul_ps(s, _mm256_loadu_ps(m + j));
+			accX = _mm256_fmadd_ps(dx, sj, accX);
+			accY = _mm256_fmadd_ps(dy, sj, accY);
+			accZ = _mm256_fmadd_ps(dz, sj, accZ);
+
+			const __m256 si = _mm256_mul_ps(s, mi);
+			_mm256_storeu_ps(ax + j, _mm256_fnmadd_ps(dx, si, _mm256_loadu_ps(ax + j)));
+			_mm256_storeu_ps(ay + j, _mm256_fnmadd_ps(dy, si, _mm256_loadu_ps(ay + j)));
+			_mm256_storeu_ps(az + j, _mm256_fnmadd_ps(dz, si, _mm256_loadu_ps(az + j)));
+		}
+		pairRowScalar(i, j, jEnd, x, y, z, m, ax, ay, az);
+		ax[i] += horizontalSum(accX);
+		ay[i] += horizontalSum(accY);
+		az[i] += horizontalSum(accZ);
+	}
+#endif
+
+	using PairRowFn = void(*)(size_t, size_t, size_t,
+		const float*, const float*, const float*, const float*,
+		float*, float*, float*);
+
+	// Below this many bodies splitting the pairs into tiles costs more than it saves
+	constexpr size_t pairParallelMin = 4096;
+	// Tile size of the deterministic mode, the same on every machine
+	constexpr size_t deterministicTileSize = 128;
+
+	// Splits the bodies into tiles and visits every pair of tiles once. The tile
+	// pairs are scheduled in rounds like a round-robin tournament (circle method):
+	// no tile appears twice in a round, so the tasks of a round never write the
+	// same accelerations and need no locks or private copies. The first round
+	// handles the pairs inside each tile. Every acceleration gets the sums of its tile
+	// pairs in round order, so the result depends on the tile size and nothing else.
+	void pairTilesParallel(PairRowFn row, ThreadPool& pool,
+		const float* x, const float* y, const float* z, const float* m,
+		size_t n, size_t tileSize,
+		float* ax, float* ay, float* az)
+	{
+		const size_t tiles = (n + tileSize - 1) / tileSize;
+		const size_t slots = tiles + (tiles & 1); // odd counts get an empty tile
+		const size_t rounds = slots; // slots - 1 tile pair rounds + the diagonal round
+
+		auto tileEnd = [&](size_t t) { return std::min(n, (t + 1) * tileSize); };
+		auto runTask = [&](size_t round, size_t k)
+			{
+				if (round == 0)
+				{
+					for (size_t i = k * tileSize; i < tileEnd(k); ++i)
+						row(i, i + 1, tileEnd(k), x, y, z, m, ax, ay, az);
+					return;
+				}
+				const size_t r = round - 1;
+				const size_t a = k == 0 ? slots - 1 : (r + k) % (slots - 1);
+				const size_t b = k == 0 ? r : (r + slots - 1 - k) % (slots - 1);
+				if (a >= tiles || b >= tiles)
+					return;
+				for (size_t i = a * tileSize; i < tileEnd(a); ++i)
+					row(i, b * tileSize, tileEnd(b), x, y, z, m, ax, ay, az);
+			};
+
+		// parallelFor returns once the whole round is done, so it doubles as the barrier between rounds
+		for (size_t round = 0; round < rounds; ++round)
+		{
+			const size_t taskCount = round == 0 ? tiles : slots / 2;
+			pool.parallelFor(taskCount, 1, [&](size_t kBegin, size_t kEnd)
+				{
+					for (size_t k = kBegin; k < kEnd; ++k)
+						runTask(round, k);
+				});
+		}
+	}
+
+	SimdLevel queryCpu()
+	{
+#if defined(_MSC_VER)
+		int regs[4];
+		__cpuid(regs, 0);
+		if (regs[0] < 7)
+			return SimdLevel::Scalar;
+		__cpuid(regs, 1);
+		const bool fma = (regs[2] & (1 << 12)) != 0;
+		const bool osxsave = (regs[2] & (1 << 27)) != 0;
+		const bool avx = (regs[2] & (1 << 28)) != 0;
+		if (!(fma && osxsave && avx))
+			return SimdLevel::Scalar;
+		// The os has to save the ymm (and zmm) registers on context switches
+		const unsigned long long xcr0 = _xgetbv(0);
+		if ((xcr0 & 0x6) != 0x6)
+			return SimdLevel::Scalar;
+		__cpuidex(regs, 7, 0);
+		const bool avx2 = (regs[1] & (1 << 5)) != 0;
+		const bool avx512f = (regs[1] & (1 << 16)) != 0;
+		if (avx512f && (xcr0 & 0xE6) == 0xE6)
+			return SimdLevel::Avx512;
+		return avx2 ? SimdLevel::Avx2 : SimdLevel::Scalar;
+#else
+		// libgcc also checks that the os saves the wide registers
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f"))
+			return SimdLevel::Avx512;
+		if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+			return SimdLevel::Avx2;
+		return SimdLevel::Scalar;
+#endif
+	}
+#else
+	SimdLevel queryCpu()
+	{
+		return SimdLevel::Scalar;
+	}
+#endif
+
+	std::atomic<SimdLevel>& activeLevel()
+	{
+		static std::atomic<SimdLevel> level = detectSimdLevel();
+		return level;
+	}
+
+	// Roughly the pair interactions a task should evaluate before it is worth running on another thread
+	constexpr size_t gravityTaskInteractions = 1 << 16;
+
+	void dispatchGravity(const float* tx, const float* ty, const float* tz, const uint32_t* targets, size_t targetCount,
+		const float* sx, const float* sy, const float* sz, const float* sm,
+		size_t n, float G,
+		float* ax, float* ay, float* az)
+	{
+		const SimdLevel level = activeLevel().load(std::memory_order_relaxed);
+		auto kernel = [&](size_t begin, size_t end)
+			{
+				switch (level)
+				{
+#if PHYS_X86
+				case SimdLevel::Avx512:
+					gravityAvx512(begin, end, tx, ty, tz, targets, sx, sy, sz, sm, n, G, ax, ay, az);
+					return;
+				case SimdLevel::Avx2:
+					gravityAvx2(begin, end, tx, ty, tz, targets, sx, sy, sz, sm, n, G, ax, ay, az);
+					return;
+#endif
+				default:
+					gravityScalar(begin, end, tx, ty, tz, targets, sx, sy, sz, sm, n, G, ax, ay, az);
+					return;
+				}
+			};
+
+		// Targets are split over the threads in blocks of 32 (whole vectors), with
+		// enough blocks per task to be worth handing to another thread
+		constexpr size_t blockSize = 32;
+		const size_t blocks = (targetCount + blockSize - 1) / blockSize;
+		const size_t grain = std::max<size_t>(1, gravityTaskInteractions / (blockSize * std::max<size_t>(n, 1)));
+		ThreadPool::get().parallelFor(blocks, grain, [&](size_t blockBegin, size_t blockEnd)
+			{
+				kernel(blockBegin * blockSize, std::min(targetCount, blockEnd * blockSize));
+			});
+	}
+}
+
+namespace phys
+{
+	SimdLevel detectSimdLevel()
+	{
+		static const SimdLevel level = queryCpu();
+		return level;
+	}
+
+	SimdLevel getSimdLevel()
+	{
+		return activeLevel().load(std::memory_order_relaxed);
+	}
+
+	void setSimdLevel(SimdLevel level)
+	{
+		activeLevel().store(level < detectSimdLevel() ? level : detectSimdLevel(), std::memory_order_relaxed);
+	}
+
+	const char* toString(SimdLevel level)
+	{
+		switch (level)
+		{
+		case SimdLevel::Avx512:
+			return "AVX-512";
+		case SimdLevel::Avx2:
+			return "AVX2";
+		default:
+			return "Scalar";
+		}
+	}
+
+	void computeGravity(const float* tx, const float* ty, const float* tz,
+		const float* sx, const float* sy, const float* sz, const float* sm,
+		size_t n, float G,
+		float* ax, float* ay, float* az)
+	{
+		dispatchGravity(tx, ty, tz, nullptr, n, sx, sy, sz, sm, n, G, ax, ay, az);
+	}
+
+	void computeGravityIndexed(const uint32_t* targets, size_t targetCount,
+		const float* x, const float* y, const float* z, const float* m,
+		size_t n, float G,
+		float* ax, float* ay, float* az)
+	{
+		dispatchGravity(x, y, z, targets, targetCount, x, y, z, m, n, G, ax, ay, az);
+	}
+
+	void computeGravityPairwise(const float* x, const float* y, const float* z, const float* m,
+		size_t n, float G,
+		float* ax, float* ay, float* az, bool deterministic)
+	{
+		computeGravityPairwise(ThreadPool::get(), x, y, z, m, n, G, ax, ay, az, deterministic);
+	}
+
+	void computeGravityPairwise(ThreadPool& pool, const float* x, const float* y, const float* z, const float* m,
+		size_t n, float G,
+		float* ax, float* ay, float* az, bool deterministic)
+	{
+		std::fill(ax, ax + n, 0.f);
+		std::fill(ay, ay + n, 0.f);
+		std::fill(az, az + n, 0.f);
+
+		PairRowFn row = pairRowScalar;
+#if PHYS_X86
+		if (getSimdLevel() >= SimdLevel::Avx2)
+			row = pairRowAvx2;
+#endif
+
+		// The fast mode fits the tiles (and whether to tile at all) to the threads,
+		// which changes the order the partial sums of a body are added up in
+		if (n < pairParallelMin || (!deterministic && pool.threadCount() <= 1))
+		{
+			for (size_t i = 0; i < n; ++i)
+				row(i, i + 1, n, x, y, z, m, ax, ay, az);
+		}
+		else
+		{
+			// About two tasks per thread and round
+			const size_t tileSize = deterministic ? deterministicTileSize
+				: std::max<size_t>(64, (n / (4 * pool.threadCount()) + 15) / 16 * 16);
+			pairTilesParallel(row, pool, x, y, z, m, n, tileSize, ax, ay, az);
+		}
+
+		for (size_t i = 0; i < n; ++i)
+		{
+			ax[i] *= G;
+			ay[i] *= G;
+			az[i] *= G;
+		}
+	}
+}
@@ -0,0 +1,82 @@
+//
+// Batched gravity kernels over structure-of-arrays positions.
+// The best instruction set (AVX-512, AVX2 or plain scalar code) is
+// picked at runtime from CPUID, so one binary runs everywhere.
+//
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+
+namespace phys
+{
+	class ThreadPool;
+
+	// Pairs closer than this (squared distance) are ignored to avoid ultra high forces
+	constexpr float gravDistSqMin = 2.5e-7f;
+	// Accelerations are clamped to this magnitude
+	constexpr float maxAcceleration = 1e6f;
+
+	// Instruction sets the kernels can run on
+	enum class SimdLevel
+	{
+		Scalar,
+		Avx2,
+		Avx512
+	};
+
+	// Best level supported by this cpu and os
+	SimdLevel detectSimdLevel();
+	// Level used by the kernels, defaults to detectSimdLevel()
+	SimdLevel getSimdLevel();
+	// Force a level (e.g. to compare them), clamped to what is supported
+	void setSimdLevel(SimdLevel level);
+	const char* toString(SimdLevel level);
+
+	// Accelerations of n targets at (tx, ty, tz) caused by the n sources at (sx, sy, sz)
+	// with masses sm. Target i always skips source i, so the targets can be the sources
+	// themselves or the same bodies moved to an intermediate integrator stage.
+	void computeGravity(const float* tx, const float* ty, const float* tz,
+		const float* sx, const float* sy, const float* sz, const float* sm,
+		size_t n, float G,
+		float* ax, float* ay, float* az);
+
+	// Accelerations of the bodies targets[0..targetCount) caused by all n bodies at
+	// (x, y, z) with masses m, each target skips itself. The result for targets[k]
+	// is written to ax[k], ay[k], az[k].
+	void computeGravityIndexed(const uint32_t* targets, size_t targetCount,
+		const float* x, const float* y, const float* z, const float* m,
+		size_t n, float G,
+		float* ax, float* ay, float* az);
+
+	// Accelerations of the n bodies at (x, y, z) with masses m caused by each other.
+	// Every pair is evaluated once and applied to both bodies with opposite signs
+	// (Newton's third law), so this does half the work of computeGravity with the
+	// bodies as both targets and sources. Large n is split into tiles that are
+	// processed on all hardware threads without two threads writing the same tile.
+	// The tiles are sized for the thread count unless deterministic is set, then
+	// they have a fixed size and the result is bitwise the same on any number of
+	// threads (for the same SimdLevel).
+	void computeGravityPairwise(const float* x, const float* y, const float* z, const float* m,
+		size_t n, float G,
+		float* ax, float* ay, float* az, bool deterministic = false);
+	// Same on the given pool instead of the shared one
+	void computeGravityPairwise(ThreadPool& pool, const float* x, const float* y, const float* z, const float* m,
+		size_t n, float G,
+		float* ax, float* ay, float* az, bool deterministic = false);
+
+	// Scale an acceleration down to maxAcceleration if it is above it
+	template<typename Real>
+	void clampAcceleration(Real& ax, Real& ay, Real& az)
+	{
+		const Real magSq = ax * ax + ay * ay + az * az;
+		if (magSq > maxAcceleration * maxAcceleration)
+		{
+			const Real s = maxAcceleration / std::sqrt(magSq);
+			ax *= s;
+			ay *= s;
+			az *= s;
+		}
+	}
+}
@@ -0,0 +1,282 @@
+// Runs a simulation without a window, for batch runs on machines without
+// a display or DirectX. Reads the starting state from a scenario file or
+// a checkpoint, runs the steps as fast as it can and writes the final
+// state and the conserved quantities. Built by CMakeLists.txt, not by the
+// Visual Studio project.
+
+#include "Simulation.h"
+#include "Checkpoint.h"
+#include "Diagnostics.h"
+#include "Logger.h"
+#include "Scenario.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace
+{
+	using phys::Simulation;
+
+	struct Options
+	{
+		std::string input;
+		std::string output; // final checkpoint, none when empty
+		std::string logFile; // conserved quantities as csv, none when empty
+		// Override the scenario's when given
+		std::optional<long long> steps;
+		std::optional<float> dt;
+		int logEvery = 1;
+		size_t threads = 0; // the shared pool when 0
+		bool exactEnergy = false; // every pair for the energy error whatever the body count
+		// Settings given on the command line, applied over the ones of the input
+		std::vector<std::pair<std::string, std::string>> settings;
+	};
+
+	void printUsage()
+	{
+		std::puts(
+			"Usage: ElecHeadless <scenario or checkpoint> [options]\n"
+			"  --steps N             steps to run (the scenario's, 1000 for a checkpoint)\n"
+			"  --dt S                step size in seconds (the scenario's, 1/120 for a checkpoint)\n"
+			"  --out FILE            write the final state as a checkpoint\n"
+			"  --log FILE            write the conserved quantities as csv\n"
+			"  --log-every N         steps between log lines (1)\n"
+			"  --threads N           threads to run on (all of them)\n"
+			"  --exact-energy        sum every pair for the energy error, past 10000 bodies too\n"
+			"  --solver direct|pairwise|barnes-hut|fmm\n"
+			"  --integrator rk4|leapfrog|verlet|yoshida4|dopri45|block\n"
+			"  --precision single|double|mixed\n"
+			"  --collisions none|merge|elastic\n"
+			"  --deterministic       same result on any number of threads");
+	}
+
+	// Index of value in names, or -1
+	template<size_t N>
+	int indexOf(const char* value, const char* const (&names)[N])
+	{
+		for (size_t i = 0; i < N; ++i)
+		{
+			if (std::strcmp(value, names[i]) == 0)
+				return (int)i;
+		}
+		return -1;
+	}
+
+	// Applies one of the setting options, returns false when it isn't one or the value is wrong
+	bool applySetting(const std::string& name, const std::string& value, Simulation::Settings& s)
+	{
+		if (name == "--deterministic")
+		{
+			s.deterministic = true;
+			return true;
+		}
+		int choice = 0;
+		if (name == "--solver" && (choice = indexOf(value.c_str(), { "direct", "pairwise", "barnes-hut", "fmm" })) >= 0)
+		{
+			s.gravitySolver = choice == 0 || choice == 1 ? Simulation::GravitySolver::Direct : (Simulation::GravitySolver)(choice - 1);
+			s.gravityPairwise = choice == 1;
+		}
+		else if (name == "--integrator" && (choice = indexOf(value.c_str(), { "rk4", "leapfrog", "verlet", "yoshida4", "dopri45", "block" })) >= 0)
+			s.integrator = (Simulation::Integrator)choice;
+		else if (name == "--precision" && (choice = indexOf(value.c_str(), { "single", "double", "mixed" })) >= 0)
+			s.precision = (Simulation::Precision)choice;
+		else if (name == "--collisions" && (choice = indexOf(value.c_str(), { "none", "merge", "elastic" })) >= 0)
+			s.collisionResponse = (Simulation::CollisionResponse)choice;
+		else
+			return false;
+		return true;
+	}
+
+	// Returns false with a message on stderr when the arguments don't make sense
+	bool parseOptions(int argc, char** argv, Options& options)
+	{
+		if (argc < 2 || argv[1][0] == '-')
+			return false;
+		options.input = argv[1];
+		for (int a = 2; a < argc; ++a)
+		{
+			const std::string name = argv[a];
+			if (name == "--deterministic")
+			{
+				options.settings.emplace_back(name, "");
+				continue;
+			}
+			if (name == "--exact-energy")
+			{
+				options.exactEnergy = true;
+				continue;
+			}
+			if (a + 1 >= argc)
+			{
+				std::fprintf(stderr, "%s needs a value\n", name.c_str());
+				return false;
+			}
+			const char* value = argv[++a];
+			Simulation::Settings check;
+			if (name == "--steps")
+				options.steps = std::atoll(value);
+			else if (name == "--dt")
+				options.dt = (float)std::atof(value);
+			else if (name == "--out")
+				options.output = value;
+			else if (name == "--log")
+				options.logFile = value;
+			else if (name == "--log-every")
+				options.logEvery = std::max(1, std::atoi(value));
+			else if (name == "--threads")
+				options.threads = (size_t)std::max(1, std::atoi(value));
+			else if (applySetting(name, value, check))
+				options.settings.emplace_back(name, value);
+			else
+			{
+				std::fprintf(stderr, "Unknown option %s %s\n", name.c_str(), value);
+				return false;
+			}
+		}
+		if (options.steps.value_or(0) < 0 || !(options.dt.value_or(1.f) > 0.f))
+		{
+			std::fputs("The steps can't be negative and dt has to be positive\n", stderr);
+			return false;
+		}
+		return true;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	if (!parseOptions(argc, argv, options))
+	{
+		printUsage();
+		return 1;
+	}
+
+	// A pool of the asked size in place of the shared one, for everything this thread runs
+	std::unique_ptr<phys::ThreadPool> pool;
+	if (options.threads > 0)
+	{
+		pool = std::make_unique<phys::ThreadPool>(options.threads - 1);
+		phys::ThreadPool::setForThisThread(pool.get());
+	}
+
+	Simulation simulation;
+	Simulation::Settings settings;
+	double time = 0;
+	long long steps = 1000;
+	float dt = 1.f / 120.f;
+	std::string error;
+	if (phys::isCheckpointFile(options.input))
+	{
+		phys::CheckpointFile file;
+		if (!file.open(options.input, error))
+		{
+			std::fprintf(stderr, "%s\n", error.c_str());
+			return 1;
+		}
+		file.loadInto(simulation.getBodies());
+		settings.G = file.getG();
+		settings.boundary = file.getBoundary();
+		settings.boundarySize = file.getBoundarySize();
+		time = file.getSimulatedTime();
+	}
+	else
+	{
+		phys::Scenario scenario;
+		if (!scenario.load(options.input, error))
+		{
+			std::fprintf(stderr, "%s\n", error.c_str());
+			return 1;
+		}
+		const auto generateStart = std::chrono::steady_clock::now();
+		scenario.generate(simulation.getBodies());
+		const std::chrono::duration<double> generateTime = std::chrono::steady_clock::now() - generateStart;
+		std::printf("Generated %zu bodies in %.3f s\n", simulation.getBodies().size(), generateTime.count());
+		settings = scenario.settings;
+		steps = scenario.steps;
+		dt = scenario.dt;
+	}
+	for (const auto& [name, value] : options.settings)
+		applySetting(name, value, settings);
+	steps = options.steps.value_or(steps);
+	dt = options.dt.value_or(dt);
+	// Measured every step only for the log, the start and the end are measured here
+	const bool logging = !options.logFile.empty();
+	settings.measureDiagnostics = logging;
+	simulation.setSettings(settings);
+
+	// The start and the end sum every pair unless that would take longer than the run, a
+	// sampled potential gives only a rough error
+	phys::DiagnosticsMeter meter;
+	const bool exactEnergy = options.exactEnergy || simulation.getBodies().size() <= phys::exactEnergyBodyLimit;
+	const phys::Diagnostics start = meter.measure(simulation.getBodies(), settings.G, exactEnergy);
+	if (logging)
+	{
+		if (!Logger::Get().OpenFile(options.logFile))
+		{
+			std::fprintf(stderr, "Can't open %s for writing\n", options.logFile.c_str());
+			return 1;
+		}
+		Logger::Get().UpdateTime((float)time);
+		Logger::Get().LogHeader("energy", "kinetic", "potential", "momentum.x", "momentum.y", "momentum.z",
+			"angularMomentum.x", "angularMomentum.y", "angularMomentum.z");
+	}
+
+	std::printf("%zu bodies, %lld steps of %g s on %zu threads\n",
+		simulation.getBodies().size(), steps, dt, phys::ThreadPool::get().threadCount());
+	size_t collisions = 0;
+	const auto wallStart = std::chrono::steady_clock::now();
+	for (long long s = 0; s < steps; ++s)
+	{
+		simulation.step(dt);
+		time += dt;
+		const phys::Simulation::Stats& stats = simulation.getStats();
+		collisions += stats.collisions.contacts + stats.collisions.merged;
+		if (logging)
+			Logger::Get().UpdateTime(dt);
+		if (logging && (s + 1) % options.logEvery == 0)
+		{
+			const phys::Diagnostics& diag = stats.diagnostics;
+			Logger::Get().LogWithTime(diag.totalEnergy(), diag.kineticEnergy, diag.potentialEnergy,
+				diag.momentum[0], diag.momentum[1], diag.momentum[2],
+				diag.angularMomentum[0], diag.angularMomentum[1], diag.angularMomentum[2]);
+		}
+	}
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+
+	const phys::BodyStore& bodies = simulation.getBodies();
+	const phys::Diagnostics end = meter.measure(bodies, settings.G, exactEnergy);
+	const double energyError = start.totalEnergy() != 0 ? std::abs((end.totalEnergy() - start.totalEnergy()) / start.totalEnergy()) : 0.0;
+	std::printf("%.3f s, %.1f steps/s\n", seconds, seconds > 0 ? steps / seconds : 0.0);
+	std::printf("%zu bodies left, %zu contacts and merges, relative energy error %.3e%s\n", bodies.size(), collisions, energyError,
+		start.potentialExact && end.potentialExact ? "" : " (estimated, --exact-energy sums every pair)");
+
+	if (!options.output.empty())
+	{
+		// The store's arrays are written as they are
+		phys::CheckpointData data;
+		data.bodyCount = bodies.size();
+		const float* fields[] = { bodies.x(), bodies.y(), bodies.z(), bodies.vx(), bodies.vy(), bodies.vz(), bodies.mass(), bodies.radius(), bodies.seed() };
+		std::copy(std::begin(fields), std::end(fields), data.fields);
+		data.simulatedTime = time;
+		data.G = settings.G;
+		data.boundarySize = settings.boundarySize;
+		data.boundary = settings.boundary;
+		std::string error;
+		if (!phys::writeCheckpoint(options.output, data, error))
+		{
+			std::fprintf(stderr, "%s\n", error.c_str());
+			return 1;
+		}
+	}
+	return 0;
+}
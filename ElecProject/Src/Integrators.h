@@ -0,0 +1,494 @@
+//
+// Integrators that advance the whole system of bodies at once.
+// Each method is a policy with a static step function, pick one at
+// compile time with integrateSystem<Method>(...). The accelerations of
+// all bodies come from one callback per force evaluation:
+//	computeAccel(const Real* const pos[3], const Real* const vel[3], Real* const acc[3])
+// The scalar type Real of the state, float or double, is deduced from the
+// position and velocity arrays. Masses and time steps stay float.
+//
+
+#pragma once
+#include "PhysEngine.h"
+#include "ScratchArena.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace phys
+{
+	// Accelerations from the end of the last step, so methods that start a step
+	// with a kick at the current positions don't have to evaluate the forces twice.
+	// They are only handed out again for bitwise the same positions and masses,
+	// anything else that changes the forces (G, solver) has to invalidate them.
+	template<typename Real>
+	class BasicAccelerationCache
+	{
+	public:
+		void invalidate()
+		{
+			valid = false;
+		}
+
+		// Copies the stored accelerations to acc if they were computed for these bodies
+		bool load(const Real* const pos[3], const float* mass, size_t n, Real* const acc[3]) const
+		{
+			if (!valid || n != count)
+				return false;
+			for (int c = 0; c < 3; ++c)
+			{
+				if (std::memcmp(pos[c], &key[c * n], n * sizeof(Real)) != 0)
+					return false;
+			}
+			if (std::memcmp(mass, massKey.data(), n * sizeof(float)) != 0)
+				return false;
+			for (int c = 0; c < 3; ++c)
+				std::copy(&accel[c * n], &accel[c * n] + n, acc[c]);
+			return true;
+		}
+
+		void store(const Real* const pos[3], const float* mass, size_t n, const Real* const acc[3])
+		{
+			key.resize(3 * n);
+			accel.resize(3 * n);
+			for (int c = 0; c < 3; ++c)
+			{
+				std::copy(pos[c], pos[c] + n, &key[c * n]);
+				std::copy(acc[c], acc[c] + n, &accel[c * n]);
+			}
+			massKey.assign(mass, mass + n);
+			count = n;
+			valid = true;
+		}
+
+	private:
+		std::vector<Real> key; // x, y, z of every body
+		std::vector<float> massKey;
+		std::vector<Real> accel; // ax, ay, az of every body
+		size_t count = 0;
+		bool valid = false;
+	};
+
+	using AccelerationCache = BasicAccelerationCache<float>;
+
+	// Classic 4th order Runge-Kutta, 4 force evaluations per step, not symplectic
+	struct RK4
+	{
+		template<typename Real, typename AccelFn>
+		static void step(Real* const pos[3], Real* const vel[3], const float*, size_t n, float dt,
+			ScratchArena& scratch, BasicAccelerationCache<Real>& cache, AccelFn&& computeAccel)
+		{
+			cache.invalidate();
+			rk4IntegrateSystem(pos, vel, n, dt, scratch, computeAccel);
+		}
+	};
+
+	// Kick-drift-kick leapfrog, 2nd order and symplectic. The closing kick's
+	// accelerations open the next step, so it costs 1 force evaluation per step.
+	struct Leapfrog
+	{
+		template<typename Real, typename AccelFn>
+		static void step(Real* const pos[3], Real* const vel[3], const float* mass, size_t n, float dt,
+			ScratchArena& scratch, BasicAccelerationCache<Real>& cache, AccelFn&& computeAccel)
+		{
+			if (n == 0)
+				return;
+			Real* block = scratch.allocate<Real>(3 * n);
+			Real* const acc[3] = { block, block + n, block + 2 * n };
+			if (!cache.load(pos, mass, n, acc))
+				computeAccel(pos, vel, acc);
+
+			kick(vel, acc, n, 0.5f * dt);
+			drift(pos, vel, n, dt);
+			// Velocity dependent forces see the half step velocity
+			computeAccel(pos, vel, acc);
+			kick(vel, acc, n, 0.5f * dt);
+			cache.store(pos, mass, n, acc);
+		}
+
+		template<typename Real>
+		static void kick(Real* const vel[3], const Real* const acc[3], size_t n, float h)
+		{
+			parallelFor(n, integrateGrain, [&](size_t begin, size_t end)
+				{
+					for (int c = 0; c < 3; ++c)
+						for (size_t i = begin; i < end; ++i)
+							vel[c][i] += acc[c][i] * h;
+				});
+		}
+
+		template<typename Real>
+		static void drift(Real* const pos[3], const Real* const vel[3], size_t n, float h)
+		{
+			parallelFor(n, integrateGrain, [&](size_t begin, size_t end)
+				{
+					for (int c = 0; c < 3; ++c)
+						for (size_t i = begin; i < end; ++i)
+							pos[c][i] += vel[c][i] * h;
+				});
+		}
+	};
+
+	// Velocity Verlet, the same trajectory as the leapfrog written as a full
+	// position update followed by the average of the old and new accelerations
+	struct VelocityVerlet
+	{
+		template<typename Real, typename AccelFn>
+		static void step(Real* const pos[3], Real* const vel[3], const float* mass, size_t n, float dt,
+			ScratchArena& scratch, BasicAccelerationCache<Real>& cache, AccelFn&& computeAccel)
+		{
+			if (n == 0)
+				return;
+			Real* block = scratch.allocate<Real>(6 * n);
+			Real* const acc[3] = { block, block + n, block + 2 * n };
+			Real* const accNew[3] = { block + 3 * n, block + 4 * n, block + 5 * n };
+			if (!cache.load(pos, mass, n, acc))
+				computeAccel(pos, vel, acc);
+
+			parallelFor(n, integrateGrain, [&](size_t begin, size_t end)
+				{
+					for (int c = 0; c < 3; ++c)
+						for (size_t i = begin; i < end; ++i)
+							pos[c][i] += (vel[c][i] + 0.5f * acc[c][i] * dt) * dt;
+				});
+			// Velocity dependent forces see the velocity at the start of the step
+			computeAccel(pos, vel, accNew);
+			parallelFor(n, integrateGrain, [&](size_t begin, size_t end)
+				{
+					for (int c = 0; c < 3; ++c)
+						for (size_t i = begin; i < end; ++i)
+							vel[c][i] += 0.5f * (acc[c][i] + accNew[c][i]) * dt;
+				});
+			cache.store(pos, mass, n, accNew);
+		}
+	};
+
+	// Yoshida / Forest-Ruth 4th order symplectic integrator, three leapfrogs with
+	// the weights w1, w0, w1 written as drift-kick-drift-kick-drift-kick-drift.
+	// 3 force evaluations per step.
+	struct Yoshida4
+	{
+		template<typename Real, typename AccelFn>
+		static void step(Real* const pos[3], Real* const vel[3], const float*, size_t n, float dt,
+			ScratchArena& scratch, BasicAccelerationCache<Real>& cache, AccelFn&& computeAccel)
+		{
+			cache.invalidate();
+			if (n == 0)
+				return;
+			// w1 = 1 / (2 - 2^(1/3)), w0 = -2^(1/3) / (2 - 2^(1/3))
+			constexpr float w1 = 1.35120719195965763f;
+			constexpr float w0 = -1.70241438391931527f;
+			constexpr float drifts[4] = { 0.5f * w1, 0.5f * (w0 + w1), 0.5f * (w0 + w1), 0.5f * w1 };
+			constexpr float kicks[3] = { w1, w0, w1 };
+
+			Real* block = scratch.allocate<Real>(3 * n);
+			Real* const acc[3] = { block, block + n, block + 2 * n };
+			for (int s = 0; s < 3; ++s)
+			{
+				Leapfrog::drift(pos, vel, n, drifts[s] * dt);
+				computeAccel(pos, vel, acc);
+				Leapfrog::kick(vel, acc, n, kicks[s] * dt);
+			}
+			Leapfrog::drift(pos, vel, n, drifts[3] * dt);
+		}
+	};
+
+	// Adaptive embedded Runge-Kutta 5(4) method of Dormand and Prince. advance() covers
+	// a time interval with as many steps as the tolerance needs: each step estimates its
+	// error from the embedded 4th order solution, is rejected and retried smaller if the
+	// error is too big, and picks the size of the next step from it. The last stage is
+	// evaluated at the new state (first same as last), so an accepted step costs 6 force
+	// evaluations, the 7th one opens the next step through the acceleration cache.
+	class DormandPrince45
+	{
+	public:
+		struct Stats
+		{
+			size_t accepted = 0;
+			size_t rejected = 0;
+			size_t forced = 0; // accepted above the tolerance because the step hit minStepFraction
+			float lastStep = 0;
+		};
+
+		// A step is accepted when the rms over every coordinate of
+		// error / (absTolerance + relTolerance * |value|) is at most 1
+		void setTolerance(float relative, float absolute)
+		{
+			relTolerance = relative;
+			absTolerance = absolute;
+		}
+		float getRelTolerance() const { return relTolerance; }
+		float getAbsTolerance() const { return absTolerance; }
+		// Counters of the last advance
+		const Stats& getStats() const { return stats; }
+
+		template<typename Real, typename AccelFn>
+		void advance(Real* const pos[3], Real* const vel[3], const float* mass, size_t n, float dt,
+			ScratchArena& scratch, BasicAccelerationCache<Real>& cache, AccelFn&& computeAccel)
+		{
+			stats = {};
+			if (n == 0 || dt <= 0)
+				return;
+
+			// Stage velocities (the position derivatives) and accelerations of the 7 stages,
+			// plus the stage positions
+			Real* block = scratch.allocate<Real>(45 * n);
+			Real* kx[7][3];
+			Real* kv[7][3];
+			for (int s = 0; s < 7; ++s)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					kx[s][c] = block + (6 * s + c) * n;
+					kv[s][c] = block + (6 * s + 3 + c) * n;
+				}
+			}
+			Real* const stagePos[3] = { block + 42 * n, block + 43 * n, block + 44 * n };
+
+			for (int c = 0; c < 3; ++c)
+				std::copy(vel[c], vel[c] + n, kx[0][c]);
+			if (!cache.load(pos, mass, n, kv[0]))
+				computeAccel(pos, vel, kv[0]);
+
+			if (step <= 0 || step > dt)
+				step = dt;
+			const float minStep = dt * minStepFraction;
+			float t = 0;
+			while (t < dt)
+			{
+				const bool last = t + step >= dt;
+				const float h = last ? dt - t : step;
+
+				for (int s = 1; s < 7; ++s)
+				{
+					for (int c = 0; c < 3; ++c)
+					{
+						for (size_t i = 0; i < n; ++i)
+						{
+							Real dx = 0, dv = 0;
+							for (int j = 0; j < s; ++j)
+							{
+								dx += A<Real>[s][j] * kx[j][c][i];
+								dv += A<Real>[s][j] * kv[j][c][i];
+							}
+							stagePos[c][i] = pos[c][i] + h * dx;
+							kx[s][c][i] = vel[c][i] + h * dv;
+						}
+					}
+					computeAccel(stagePos, kx[s], kv[s]);
+				}
+
+				// The 7th stage is the 5th order solution, compare it with the 4th order one
+				double errSq = 0;
+				for (int c = 0; c < 3; ++c)
+				{
+					for (size_t i = 0; i < n; ++i)
+					{
+						Real ex = 0, ev = 0;
+						for (int j = 0; j < 7; ++j)
+						{
+							ex += E<Real>[j] * kx[j][c][i];
+							ev += E<Real>[j] * kv[j][c][i];
+						}
+						const Real sx = absTolerance + relTolerance * std::max(std::abs(pos[c][i]), std::abs(stagePos[c][i]));
+						const Real sv = absTolerance + relTolerance * std::max(std::abs(vel[c][i]), std::abs(kx[6][c][i]));
+						errSq += (double)(h * ex / sx) * (h * ex / sx) + (double)(h * ev / sv) * (h * ev / sv);
+					}
+				}
+				const float err = (float)std::sqrt(errSq / (6 * n));
+
+				const bool forced = err > 1.f && h <= minStep;
+				if (err <= 1.f || forced)
+				{
+					for (int c = 0; c < 3; ++c)
+					{
+						std::copy(stagePos[c], stagePos[c] + n, pos[c]);
+						std::copy(kx[6][c], kx[6][c] + n, vel[c]);
+						std::swap(kx[0][c], kx[6][c]);
+						std::swap(kv[0][c], kv[6][c]);
+					}
+					t = last ? dt : t + h;
+					++stats.accepted;
+					stats.forced += forced ? 1 : 0;
+					stats.lastStep = h;
+				}
+				else
+				{
+					++stats.rejected;
+				}
+
+				// Standard controller for a 5th order method, with a safety factor and
+				// limits on how fast the step may change. A step shortened to land on
+				// the end of the interval doesn't shrink the next one.
+				const float factor = err > 0 ? std::clamp(0.9f * std::pow(err, -0.2f), 0.2f, 5.f) : 5.f;
+				step = std::max(minStep, std::min(dt, (last && err <= 1.f ? std::max(h, step) : h) * factor));
+			}
+
+			const Real* const accEnd[3] = { kv[0][0], kv[0][1], kv[0][2] };
+			cache.store(pos, mass, n, accEnd);
+		}
+
+	private:
+		// Butcher tableau, the 7th row is also the 5th order solution
+		template<typename Real>
+		static constexpr Real A[7][6] = {
+			{},
+			{ Real(1) / 5 },
+			{ Real(3) / 40, Real(9) / 40 },
+			{ Real(44) / 45, Real(-56) / 15, Real(32) / 9 },
+			{ Real(19372) / 6561, Real(-25360) / 2187, Real(64448) / 6561, Real(-212) / 729 },
+			{ Real(9017) / 3168, Real(-355) / 33, Real(46732) / 5247, Real(49) / 176, Real(-5103) / 18656 },
+			{ Real(35) / 384, 0, Real(500) / 1113, Real(125) / 192, Real(-2187) / 6784, Real(11) / 84 } };
+		// 5th order weights minus the embedded 4th order ones
+		template<typename Real>
+		static constexpr Real E[7] = { Real(71) / 57600, 0, Real(-71) / 16695, Real(71) / 1920, Real(-17253) / 339200, Real(22) / 525, Real(-1) / 40 };
+		// Steps never get shorter than this fraction of the interval given to advance
+		static constexpr float minStepFraction = 1e-4f;
+
+	private:
+		float relTolerance = 1e-5f;
+		float absTolerance = 1e-5f;
+		float step = 0; // size of the next step, 0 until the first advance
+		Stats stats;
+	};
+
+	// Kick-drift-kick leapfrog where every body advances on its own power of two
+	// fraction of the interval (hierarchical block time steps). Body i sits on level
+	// l and steps dt / 2^l, chosen from its acceleration a and radius r as the
+	// largest step not above sqrt(2 * accuracy * r / |a|). Every body drifts between
+	// the step boundaries, but only the bodies that end a step there (the active
+	// ones) get their forces evaluated and are kicked. A body can move to a finer
+	// level whenever it ends a step, to a coarser one only where that level's steps
+	// line up. The accelerations come from one callback per boundary:
+	//	computeAccel(const uint32_t* active, size_t activeCount,
+	//		const Real* const pos[3], const Real* const vel[3], Real* const acc[3])
+	// which writes the acceleration of body active[k] to acc[c][k], or of every body
+	// when active is nullptr.
+	class BlockTimesteps
+	{
+	public:
+		static constexpr int MaxLevel = 16;
+
+		struct Stats
+		{
+			size_t boundaries = 0; // times the active bodies were kicked
+			size_t forceEvaluations = 0; // bodies whose forces were evaluated
+			int deepestLevel = 0;
+		};
+
+		// Smaller is more accurate and puts bodies on finer levels
+		void setAccuracy(float newAccuracy) { accuracy = newAccuracy; }
+		float getAccuracy() const { return accuracy; }
+		// Counters of the last advance
+		const Stats& getStats() const { return stats; }
+
+		template<typename Real, typename AccelFn>
+		void advance(Real* const pos[3], Real* const vel[3], const float* mass, const float* radius, size_t n, float dt,
+			ScratchArena& scratch, BasicAccelerationCache<Real>& cache, AccelFn&& computeAccel)
+		{
+			stats = {};
+			if (n == 0 || dt <= 0)
+				return;
+
+			// Time is counted in ticks of the finest level
+			constexpr uint32_t ticks = 1u << MaxLevel;
+			const float tickTime = dt / ticks;
+			Real* block = scratch.allocate<Real>(6 * n);
+			Real* const acc[3] = { block, block + n, block + 2 * n };
+			Real* const activeAcc[3] = { block + 3 * n, block + 4 * n, block + 5 * n };
+			uint32_t* active = scratch.allocate<uint32_t>(n);
+			uint8_t* level = scratch.allocate<uint8_t>(n);
+
+			// Every body is in sync at the start, so each one can pick any level
+			if (!cache.load(pos, mass, n, acc))
+			{
+				computeAccel(nullptr, n, pos, vel, acc);
+				stats.forceEvaluations += n;
+			}
+			for (size_t i = 0; i < n; ++i)
+				level[i] = (uint8_t)levelFor(acc[0][i], acc[1][i], acc[2][i], radius[i], dt);
+
+			uint32_t t = 0;
+			while (t < ticks)
+			{
+				// Opening half kick of the bodies starting a step, then find the next boundary
+				uint32_t next = ticks;
+				for (size_t i = 0; i < n; ++i)
+				{
+					const uint32_t length = ticks >> level[i];
+					if (t % length == 0)
+					{
+						const float h = 0.5f * length * tickTime;
+						for (int c = 0; c < 3; ++c)
+							vel[c][i] += acc[c][i] * h;
+					}
+					next = std::min(next, t - t % length + length);
+				}
+
+				const float drift = (next - t) * tickTime;
+				for (int c = 0; c < 3; ++c)
+					for (size_t i = 0; i < n; ++i)
+						pos[c][i] += vel[c][i] * drift;
+				t = next;
+
+				size_t activeCount = 0;
+				for (size_t i = 0; i < n; ++i)
+				{
+					if (t % (ticks >> level[i]) == 0)
+						active[activeCount++] = (uint32_t)i;
+				}
+				computeAccel(activeCount == n ? nullptr : active, activeCount, pos, vel, activeAcc);
+				++stats.boundaries;
+				stats.forceEvaluations += activeCount;
+
+				// Closing half kick and the level of the next step
+				for (size_t k = 0; k < activeCount; ++k)
+				{
+					const size_t i = activeCount == n ? k : active[k];
+					const float h = 0.5f * (ticks >> level[i]) * tickTime;
+					for (int c = 0; c < 3; ++c)
+					{
+						acc[c][i] = activeAcc[c][k];
+						vel[c][i] += acc[c][i] * h;
+					}
+					stats.deepestLevel = std::max(stats.deepestLevel, (int)level[i]);
+					int newLevel = levelFor(acc[0][i], acc[1][i], acc[2][i], radius[i], dt);
+					while (newLevel < level[i] && t % (ticks >> newLevel) != 0)
+						++newLevel;
+					level[i] = (uint8_t)newLevel;
+				}
+			}
+
+			// Every body ended a step at the end of the interval
+			cache.store(pos, mass, n, acc);
+		}
+
+	private:
+		template<typename Real>
+		int levelFor(Real ax, Real ay, Real az, float r, float dt) const
+		{
+			const float accSq = (float)(ax * ax + ay * ay + az * az);
+			if (accSq <= 0)
+				return 0;
+			// dt / 2^l <= sqrt(2 * accuracy * r / |a|)  <=>  2^(2l) >= dt^2 |a| / (2 * accuracy * r)
+			const float ratioSq = dt * dt * std::sqrt(accSq) / (2.f * accuracy * std::max(r, 1e-6f));
+			if (ratioSq <= 1.f)
+				return 0;
+			return std::min(MaxLevel, (int)std::ceil(0.5f * std::log2(ratioSq)));
+		}
+
+	private:
+		float accuracy = 0.02f;
+		Stats stats;
+	};
+
+	// Advance every body by one step of Method
+	template<typename Method, typename Real, typename AccelFn>
+	void integrateSystem(Real* const pos[3], Real* const vel[3], const float* mass, size_t n, float dt,
+		ScratchArena& scratch, BasicAccelerationCache<Real>& cache, AccelFn&& computeAccel)
+	{
+		Method::step(pos, vel, mass, n, dt, scratch, cache, computeAccel);
+	}
+}
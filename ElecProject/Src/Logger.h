@@ -3,7 +3,7 @@
 #include <fstream>
 #include <cassert>
 #include <iostream>
-#include <DirectXMath.h>
+#include "PhysMath.h"
 #include <type_traits>
 
 class Logger
@@ -20,10 +20,11 @@ public:
 		return instance;
 	}
 
-	void OpenFile(const std::string& filename)
+	// Returns false when the file can't be opened
+	bool OpenFile(const std::string& filename)
 	{
 		file.open(filename);
-		assert(isFileOpen() && "Failed to open file");
+		return isFileOpen();
 	}
 
 	void CloseFile()
@@ -1,7 +1,14 @@
 #pragma once
 
-#include <DirectXMath.h>
-#include <functional>
+#include "GravityKernels.h"
+#include "ScratchArena.h"
+#include "ThreadPool.h"
+#include "PhysMath.h"
+#include <vector>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
 
 namespace phys
 {
@@ -18,17 +25,12 @@ namespace phys
 		DirectX::XMVECTOR acceleration;
 	};
 
-	// Abstract force class represents different types of forces between objects
-	class Force
-	{
-	public:
-		// Pure virtual compute class computes the force vector given a state
-		virtual DirectX::XMVECTOR compute(const State& state) = 0;
-		virtual ~Force() = default;
-	};
+	// The force classes compute the force vector on one object given its state.
+	// They have no common base, the integrators take them (or any other callable)
+	// as a template parameter so the calls can be inlined.
 
 	// Gravitational force
-	class GravForce : public Force
+	class GravForce
 	{
 	public:
 		GravForce(const std::vector<State>& affectingObjects, 
@@ -42,7 +44,7 @@ namespace phys
 		{
 		}
 
-		DirectX::XMVECTOR compute(const State& state) override
+		DirectX::XMVECTOR compute(const State& state) const
 		{
 			using namespace DirectX;
 			XMVECTOR netF = XMVectorZero();
@@ -52,13 +54,12 @@ namespace phys
 				float sMass = otherMasses[i];
 
 				XMVECTOR r = XMVectorSubtract(s.position, state.position); // displacement
-				XMVECTOR distSqVec = XMVector3Length(r); // This could be sped up
+				XMVECTOR distSqVec = XMVector3LengthSq(r);
 				float distSq;
 				XMStoreFloat(&distSq, distSqVec);
 				
 				// Add a clamp condition to set a minimum distance to avoid ultra high forces
-				constexpr const float distSqMin = 2.5e-7;
-				if (distSq < distSqMin)
+				if (distSq < gravDistSqMin)
 					continue;
 
 				XMVECTOR rHat = XMVector3Normalize(r); // Could be sped up
@@ -75,15 +76,308 @@ namespace phys
 		float G;
 		float mass;
 	};
+
+	// Octree that approximates the pull of far away groups of bodies by their
+	// multipole moments (Barnes-Hut). Build it once per step from the frozen states,
+	// then query it once per body instead of looping over every other body.
+	class BarnesHutTree
+	{
+	public:
+		// Rebuild the tree, the internal buffers are reused between builds
+		void build(const std::vector<State>& states, const std::vector<float>& masses)
+		{
+			using namespace DirectX;
+			const uint32_t n = (uint32_t)states.size();
+			nodes.clear();
+			positions.resize(n);
+			bodyMasses.resize(n);
+			order.resize(n);
+			scratch.resize(n);
+			slotOf.resize(n);
+			if (n == 0)
+				return;
+
+			// Find the bounding cube of all bodies
+			XMFLOAT3 lo, hi;
+			XMStoreFloat3(&lo, states[0].position);
+			hi = lo;
+			for (uint32_t i = 0; i < n; ++i)
+			{
+				XMStoreFloat3(&positions[i], states[i].position);
+				bodyMasses[i] = masses[i];
+				order[i] = i;
+				lo.x = std::min(lo.x, positions[i].x); hi.x = std::max(hi.x, positions[i].x);
+				lo.y = std::min(lo.y, positions[i].y); hi.y = std::max(hi.y, positions[i].y);
+				lo.z = std::min(lo.z, positions[i].z); hi.z = std::max(hi.z, positions[i].z);
+			}
+			const float halfSize = 0.5f * std::max({ hi.x - lo.x, hi.y - lo.y, hi.z - lo.z }) + 1e-3f;
+
+			nodes.reserve(2 * n / leafCapacity + 1);
+			nodes.emplace_back();
+			buildNode(0, 0, n, { 0.5f * (lo.x + hi.x), 0.5f * (lo.y + hi.y), 0.5f * (lo.z + hi.z) }, halfSize, 0);
+
+			for (uint32_t slot = 0; slot < n; ++slot)
+				slotOf[order[slot]] = slot;
+		}
+
+		// Acceleration at pos caused by every body in the tree except selfIndex.
+		// theta is the opening angle, smaller is more accurate and slower.
+		DirectX::XMVECTOR computeAcceleration(DirectX::FXMVECTOR pos, size_t selfIndex, float G, float theta, bool useQuadrupole) const
+		{
+			using namespace DirectX;
+			if (nodes.empty())
+				return XMVectorZero();
+
+			XMFLOAT3 p;
+			XMStoreFloat3(&p, pos);
+			const uint32_t selfSlot = selfIndex < slotOf.size() ? slotOf[selfIndex] : UINT32_MAX;
+			const float theta2 = theta * theta;
+			float ax = 0, ay = 0, az = 0;
+
+			std::array<uint32_t, 8 * maxDepth + 8> stack;
+			size_t top = 0;
+			stack[top++] = 0;
+			while (top > 0)
+			{
+				const Node& node = nodes[stack[--top]];
+
+				if (node.childCount == 0)
+				{
+					// Leaf, sum the bodies directly
+					for (uint32_t slot = node.begin; slot < node.begin + node.count; ++slot)
+					{
+						if (slot == selfSlot)
+							continue;
+						const uint32_t b = order[slot];
+						const float dx = positions[b].x - p.x;
+						const float dy = positions[b].y - p.y;
+						const float dz = positions[b].z - p.z;
+						const float distSq = dx * dx + dy * dy + dz * dz;
+						if (distSq < gravDistSqMin)
+							continue;
+						const float s = bodyMasses[b] / (distSq * std::sqrt(distSq));
+						ax += dx * s; ay += dy * s; az += dz * s;
+					}
+					continue;
+				}
+
+				const float dx = node.com.x - p.x;
+				const float dy = node.com.y - p.y;
+				const float dz = node.com.z - p.z;
+				const float distSq = dx * dx + dy * dy + dz * dz;
+				const float size = 2.f * node.halfSize;
+				const bool containsSelf = selfSlot - node.begin < node.count;
+
+				if (!containsSelf && size * size < theta2 * distSq)
+				{
+					// Far enough away, use the moments of the whole node
+					const float invDist = 1.f / std::sqrt(distSq);
+					const float invDist3 = invDist * invDist * invDist;
+					float s = node.mass * invDist3;
+					ax += dx * s; ay += dy * s; az += dz * s;
+
+					if (useQuadrupole)
+					{
+						// Second order term of the expansion about the center of mass,
+						// with X = p - com and S the second mass moment:
+						// 3/r^5 * (S X + tr(S)/2 X - 5/2 X (X.S.X) / r^2)
+						const float x = -dx, y = -dy, z = -dz;
+						const auto& q = node.quad; // xx, yy, zz, xy, xz, yz
+						const float sx = q[0] * x + q[3] * y + q[4] * z;
+						const float sy = q[3] * x + q[1] * y + q[5] * z;
+						const float sz = q[4] * x + q[5] * y + q[2] * z;
+						const float invDist2 = invDist * invDist;
+						const float halfTrace = 0.5f * (q[0] + q[1] + q[2]);
+						const float xsx = (x * sx + y * sy + z * sz) * invDist2;
+						const float k = 3.f * invDist3 * invDist2;
+						s = halfTrace - 2.5f * xsx;
+						ax += k * (sx + x * s);
+						ay += k * (sy + y * s);
+						az += k * (sz + z * s);
+					}
+					continue;
+				}
+
+				for (uint32_t c = 0; c < node.childCount; ++c)
+					stack[top++] = node.firstChild + c;
+			}
+
+			return XMVectorScale(XMVectorSet(ax, ay, az, 0.f), G);
+		}
+
+	private:
+		struct Node
+		{
+			DirectX::XMFLOAT3 com = { 0,0,0 }; // center of mass
+			float mass = 0;
+			float halfSize = 0;
+			std::array<float, 6> quad = {}; // second mass moment about com: xx, yy, zz, xy, xz, yz
+			uint32_t begin = 0; // first slot in order
+			uint32_t count = 0;
+			uint32_t firstChild = 0; // children are stored next to each other
+			uint32_t childCount = 0;
+		};
+
+		static constexpr uint32_t leafCapacity = 8;
+		static constexpr uint32_t maxDepth = 24;
+
+		void buildNode(uint32_t idx, uint32_t begin, uint32_t end, DirectX::XMFLOAT3 center, float halfSize, uint32_t depth)
+		{
+			nodes[idx].begin = begin;
+			nodes[idx].count = end - begin;
+			nodes[idx].halfSize = halfSize;
+
+			if (end - begin <= leafCapacity || depth >= maxDepth)
+			{
+				computeLeafMoments(nodes[idx]);
+				return;
+			}
+
+			// Bucket the bodies into octants (counting sort through the scratch buffer)
+			auto octant = [&](uint32_t b)
+				{
+					const auto& pos = positions[b];
+					return (pos.x > center.x ? 1u : 0u) | (pos.y > center.y ? 2u : 0u) | (pos.z > center.z ? 4u : 0u);
+				};
+			std::array<uint32_t, 9> offsets = {};
+			for (uint32_t slot = begin; slot < end; ++slot)
+				++offsets[octant(order[slot]) + 1];
+			for (uint32_t o = 0; o < 8; ++o)
+				offsets[o + 1] += offsets[o];
+			std::array<uint32_t, 8> cursor;
+			std::copy(offsets.begin(), offsets.begin() + 8, cursor.begin());
+			for (uint32_t slot = begin; slot < end; ++slot)
+				scratch[begin + cursor[octant(order[slot])]++] = order[slot];
+			std::copy(scratch.begin() + begin, scratch.begin() + end, order.begin() + begin);
+
+			// Allocate the non-empty children next to each other
+			const uint32_t firstChild = (uint32_t)nodes.size();
+			uint32_t childCount = 0;
+			for (uint32_t o = 0; o < 8; ++o)
+				childCount += offsets[o + 1] > offsets[o] ? 1 : 0;
+			nodes.resize(nodes.size() + childCount);
+			nodes[idx].firstChild = firstChild;
+			nodes[idx].childCount = childCount;
+
+			const float childHalf = 0.5f * halfSize;
+			uint32_t child = firstChild;
+			for (uint32_t o = 0; o < 8; ++o)
+			{
+				if (offsets[o + 1] == offsets[o])
+					continue;
+				DirectX::XMFLOAT3 childCenter = {
+					center.x + ((o & 1) ? childHalf : -childHalf),
+					center.y + ((o & 2) ? childHalf : -childHalf),
+					center.z + ((o & 4) ? childHalf : -childHalf) };
+				buildNode(child++, begin + offsets[o], begin + offsets[o + 1], childCenter, childHalf, depth + 1);
+			}
+
+			// Combine the children moments, shifting the second moments to the new com (parallel axis)
+			Node& node = nodes[idx];
+			for (uint32_t c = firstChild; c < firstChild + childCount; ++c)
+			{
+				node.mass += nodes[c].mass;
+				node.com.x += nodes[c].mass * nodes[c].com.x;
+				node.com.y += nodes[c].mass * nodes[c].com.y;
+				node.com.z += nodes[c].mass * nodes[c].com.z;
+			}
+			finishCom(node);
+			for (uint32_t c = firstChild; c < firstChild + childCount; ++c)
+			{
+				const Node& ch = nodes[c];
+				for (size_t k = 0; k < 6; ++k)
+					node.quad[k] += ch.quad[k];
+				addPointMoment(node, ch.com, ch.mass);
+			}
+		}
+
+		void computeLeafMoments(Node& node) const
+		{
+			for (uint32_t slot = node.begin; slot < node.begin + node.count; ++slot)
+			{
+				const uint32_t b = order[slot];
+				node.mass += bodyMasses[b];
+				node.com.x += bodyMasses[b] * positions[b].x;
+				node.com.y += bodyMasses[b] * positions[b].y;
+				node.com.z += bodyMasses[b] * positions[b].z;
+			}
+			finishCom(node);
+			for (uint32_t slot = node.begin; slot < node.begin + node.count; ++slot)
+				addPointMoment(node, positions[order[slot]], bodyMasses[order[slot]]);
+		}
+
+		static void finishCom(Node& node)
+		{
+			if (node.mass > 0)
+			{
+				node.com.x /= node.mass;
+				node.com.y /= node.mass;
+				node.com.z /= node.mass;
+			}
+		}
+
+		static void addPointMoment(Node& node, const DirectX::XMFLOAT3& pos, float m)
+		{
+			const float x = pos.x - node.com.x;
+			const float y = pos.y - node.com.y;
+			const float z = pos.z - node.com.z;
+			node.quad[0] += m * x * x;
+			node.quad[1] += m * y * y;
+			node.quad[2] += m * z * z;
+			node.quad[3] += m * x * y;
+			node.quad[4] += m * x * z;
+			node.quad[5] += m * y * z;
+		}
+
+	private:
+		std::vector<Node> nodes;
+		std::vector<DirectX::XMFLOAT3> positions;
+		std::vector<float> bodyMasses;
+		std::vector<uint32_t> order; // tree slot -> body index, each node owns a contiguous range
+		std::vector<uint32_t> scratch;
+		std::vector<uint32_t> slotOf; // body index -> tree slot
+	};
+
+	// Gravitational force approximated through a Barnes-Hut tree
+	class BarnesHutGravForce
+	{
+	public:
+		BarnesHutGravForce(const BarnesHutTree& tree, size_t selfIndex, float G, float mass, float theta, bool useQuadrupole)
+			:
+			tree(tree)
+			, selfIndex(selfIndex)
+			, G(G)
+			, mass(mass)
+			, theta(theta)
+			, useQuadrupole(useQuadrupole)
+		{
+		}
+
+		DirectX::XMVECTOR compute(const State& state) const
+		{
+			return DirectX::XMVectorScale(tree.computeAcceleration(state.position, selfIndex, G, theta, useQuadrupole), mass);
+		}
+
+	private:
+		const BarnesHutTree& tree;
+		size_t selfIndex; // The body this force acts on, it is skipped in the tree
+		float G;
+		float mass;
+		float theta;
+		bool useQuadrupole;
+	};
 	
 
 	// Generic integration function given a state
 	// (I could add a time variable here if for some reason I don't
 	// have a time-independent system in the future)
+	// accelerationFunction is any callable XMVECTOR(const State&), it is a template
+	// parameter so the four calls get inlined instead of going through std::function.
+	template<typename AccelFn>
 	void rk4Integrate(
 		State& state, // obj current state
 		float dt, // time step
-		const std::function<DirectX::XMVECTOR(const State& state)>& accelerationFunction ) // Function to compute acceleration	
+		AccelFn&& accelerationFunction ) // Function to compute acceleration	
 	{
 		using namespace DirectX;
 		// k1 calcs
@@ -132,5 +426,76 @@ namespace phys
 		state.position = XMVectorAdd(state.position, XMVectorScale(dxdt, dt));
 		state.velocity = XMVectorAdd(state.velocity, XMVectorScale(dvdt, dt));
 	}
-	
+
+	// Bodies per task for the per body loops of the integrators, they are cheap
+	// next to the force evaluation and only pay off split for big systems
+	constexpr size_t integrateGrain = 16384;
+
+	// Advances every body by one RK4 step. Unlike rk4Integrate each stage moves all
+	// bodies together, so the bodies see each other's intermediate states instead of
+	// the ones at the start of the step. The accelerations of all n bodies at a stage
+	// come from a single call:
+	//	computeAccel(const Real* const pos[3], const Real* const vel[3], Real* const acc[3])
+	// with Real float or double. The stage arrays are taken from the scratch arena.
+	template<typename Real, typename AccelFn>
+	void rk4IntegrateSystem(
+		Real* const pos[3], Real* const vel[3], // x, y, z arrays of every body
+		size_t n,
+		float dt,
+		ScratchArena& scratch,
+		AccelFn&& computeAccel)
+	{
+		if (n == 0)
+			return;
+		Real* block = scratch.allocate<Real>(15 * n);
+		Real* stagePos[3] = { block, block + n, block + 2 * n };
+		Real* stageVel[3] = { block + 3 * n, block + 4 * n, block + 5 * n };
+		Real* accel[3] = { block + 6 * n, block + 7 * n, block + 8 * n };
+		Real* dxdt[3] = { block + 9 * n, block + 10 * n, block + 11 * n };
+		Real* dvdt[3] = { block + 12 * n, block + 13 * n, block + 14 * n };
+
+		for (int c = 0; c < 3; ++c)
+		{
+			std::copy(pos[c], pos[c] + n, stagePos[c]);
+			std::copy(vel[c], vel[c] + n, stageVel[c]);
+			std::fill(dxdt[c], dxdt[c] + n, Real(0));
+			std::fill(dvdt[c], dvdt[c] + n, Real(0));
+		}
+
+		const float stageStep[3] = { dt * 0.5f, dt * 0.5f, dt };
+		const float stageWeight[4] = { 1.f, 2.f, 2.f, 1.f };
+		for (int stage = 0; stage < 4; ++stage)
+		{
+			const Real* const stagePosIn[3] = { stagePos[0], stagePos[1], stagePos[2] };
+			const Real* const stageVelIn[3] = { stageVel[0], stageVel[1], stageVel[2] };
+			computeAccel(stagePosIn, stageVelIn, accel);
+
+			parallelFor(n, integrateGrain, [&](size_t begin, size_t end)
+				{
+					for (int c = 0; c < 3; ++c)
+					{
+						for (size_t i = begin; i < end; ++i)
+						{
+							dxdt[c][i] += stageWeight[stage] * stageVel[c][i];
+							dvdt[c][i] += stageWeight[stage] * accel[c][i];
+							// Next stage starts from the original state
+							if (stage < 3)
+							{
+								stagePos[c][i] = pos[c][i] + stageVel[c][i] * stageStep[stage];
+								stageVel[c][i] = vel[c][i] + accel[c][i] * stageStep[stage];
+							}
+						}
+					}
+				});
+		}
+
+		for (int c = 0; c < 3; ++c)
+		{
+			for (size_t i = 0; i < n; ++i)
+			{
+				pos[c][i] += dxdt[c][i] * dt / 6.f;
+				vel[c][i] += dvdt[c][i] * dt / 6.f;
+			}
+		}
+	}
 }
\ No newline at end of file
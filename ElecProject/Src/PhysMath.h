@@ -0,0 +1,142 @@
+//
+// Vector math of the physics. On Windows this is DirectXMath itself.
+// Everywhere else the few DirectXMath types and functions the physics
+// uses are defined here in plain C++ under the same names, so the
+// physics core builds without the Windows SDK (see HeadlessMain.cpp).
+// The compiler vectorizes the four lane loops on its own.
+//
+
+#pragma once
+#if defined(_WIN32)
+#include <DirectXMath.h>
+#else
+#include <cmath>
+
+namespace DirectX
+{
+	struct XMFLOAT3
+	{
+		float x, y, z;
+	};
+
+	struct XMFLOAT4
+	{
+		float x, y, z, w;
+	};
+
+	struct alignas(16) XMVECTOR
+	{
+		float v[4];
+	};
+
+	// DirectXMath passes the first vectors in registers through these
+	using FXMVECTOR = const XMVECTOR;
+	using GXMVECTOR = const XMVECTOR;
+	using CXMVECTOR = const XMVECTOR&;
+
+	inline XMVECTOR XMVectorSet(float x, float y, float z, float w)
+	{
+		return { { x, y, z, w } };
+	}
+
+	inline XMVECTOR XMVectorZero()
+	{
+		return { { 0.f, 0.f, 0.f, 0.f } };
+	}
+
+	inline XMVECTOR XMVectorReplicate(float value)
+	{
+		return { { value, value, value, value } };
+	}
+
+	inline float XMVectorGetX(FXMVECTOR v)
+	{
+		return v.v[0];
+	}
+
+	inline XMVECTOR XMVectorAdd(FXMVECTOR a, FXMVECTOR b)
+	{
+		XMVECTOR r;
+		for (int i = 0; i < 4; ++i)
+			r.v[i] = a.v[i] + b.v[i];
+		return r;
+	}
+
+	inline XMVECTOR XMVectorSubtract(FXMVECTOR a, FXMVECTOR b)
+	{
+		XMVECTOR r;
+		for (int i = 0; i < 4; ++i)
+			r.v[i] = a.v[i] - b.v[i];
+		return r;
+	}
+
+	inline XMVECTOR XMVectorMultiply(FXMVECTOR a, FXMVECTOR b)
+	{
+		XMVECTOR r;
+		for (int i = 0; i < 4; ++i)
+			r.v[i] = a.v[i] * b.v[i];
+		return r;
+	}
+
+	inline XMVECTOR XMVectorScale(FXMVECTOR v, float s)
+	{
+		XMVECTOR r;
+		for (int i = 0; i < 4; ++i)
+			r.v[i] = v.v[i] * s;
+		return r;
+	}
+
+	// The 3D functions put their result in every lane, like DirectXMath
+	inline XMVECTOR XMVector3Dot(FXMVECTOR a, FXMVECTOR b)
+	{
+		return XMVectorReplicate(a.v[0] * b.v[0] + a.v[1] * b.v[1] + a.v[2] * b.v[2]);
+	}
+
+	inline XMVECTOR XMVector3LengthSq(FXMVECTOR v)
+	{
+		return XMVector3Dot(v, v);
+	}
+
+	inline XMVECTOR XMVector3Length(FXMVECTOR v)
+	{
+		return XMVectorReplicate(std::sqrt(XMVectorGetX(XMVector3LengthSq(v))));
+	}
+
+	inline XMVECTOR XMVector3LengthEst(FXMVECTOR v)
+	{
+		return XMVector3Length(v);
+	}
+
+	// A zero vector stays zero
+	inline XMVECTOR XMVector3Normalize(FXMVECTOR v)
+	{
+		const float length = XMVectorGetX(XMVector3Length(v));
+		return length > 0.f ? XMVectorScale(v, 1.f / length) : v;
+	}
+
+	inline XMVECTOR XMLoadFloat3(const XMFLOAT3* source)
+	{
+		return { { source->x, source->y, source->z, 0.f } };
+	}
+
+	inline XMVECTOR XMLoadFloat4(const XMFLOAT4* source)
+	{
+		return { { source->x, source->y, source->z, source->w } };
+	}
+
+	inline void XMStoreFloat(float* destination, FXMVECTOR v)
+	{
+		*destination = v.v[0];
+	}
+
+	inline void XMStoreFloat3(XMFLOAT3* destination, FXMVECTOR v)
+	{
+		*destination = { v.v[0], v.v[1], v.v[2] };
+	}
+
+	inline void XMStoreFloat4(XMFLOAT4* destination, FXMVECTOR v)
+	{
+		*destination = { v.v[0], v.v[1], v.v[2], v.v[3] };
+	}
+}
+#endif
@@ -4,15 +4,59 @@
 #include "Logger.h"
 #include <cassert>
 
-Planet::Planet(Graphics& gfx, float patternseed, DirectX::XMFLOAT3 pos /*= { 0,0,0 }*/, float radius /*= 1.0f*/)
+Planet::Planet(Graphics& gfx, phys::SimulationThread& simulation, float patternseed, DirectX::XMFLOAT3 pos /*= { 0,0,0 }*/, float radius /*= 1.0f*/)
 	: Sphere(gfx, patternseed, pos, {radius, radius, radius})
-	, radius(radius)
+	, simulation(simulation)
 {
+	body.x = pos.x;
+	body.y = pos.y;
+	body.z = pos.z;
+	body.mass = 100.f;
+	body.radius = radius;
+	body.seed = patternseed;
+	bodyId = simulation.addBody(body, &lastEdit);
+}
+
+Planet::Planet(Graphics& gfx, phys::SimulationThread& simulation, const phys::Body& body)
+	: Sphere(gfx, body.seed, { body.x, body.y, body.z }, { body.radius, body.radius, body.radius })
+	, simulation(simulation)
+	, body(body)
+{
+	bodyId = simulation.addBody(body, &lastEdit);
+}
+
+Planet::~Planet()
+{
+	simulation.removeBody(bodyId);
+}
+
+bool Planet::Sync(const phys::Snapshot& snapshot)
+{
+	const size_t i = snapshot.indexOf(bodyId);
+	if (snapshot.commandsApplied < lastEdit || i == phys::BodyStore::InvalidIndex)
+		return false;
+	const float oldRadius = body.radius;
+	body = snapshot.bodies[i];
+	// Merging makes planets grow
+	if (body.radius != oldRadius)
+		setScaling(body.radius);
+	return true;
+}
 
+bool Planet::IsGone(const phys::Snapshot& snapshot) const
+{
+	return snapshot.commandsApplied >= lastEdit && snapshot.indexOf(bodyId) == phys::BodyStore::InvalidIndex;
 }
 
 void Planet::Draw(Graphics& gfx)
 {
+	// Pull the simulated position into the world matrix
+	DrawAt(gfx, { body.x, body.y, body.z });
+}
+
+void Planet::DrawAt(Graphics& gfx, const DirectX::XMFLOAT3& renderPos)
+{
+	SetPosition(renderPos);
 	Sphere::Draw(gfx);
 	if (ControlWindowEnabled)
 		DrawControlWindow();
@@ -21,29 +65,42 @@ void Planet::Draw(Graphics& gfx)
 // Returns mass in KG
 float Planet::GetMass() const
 {
-	return _mass;
+	return body.mass;
 }
 
 void Planet::SetMass(float newMass)
 {
 	assert(newMass > 0);
-	_mass = newMass;
-	_invMass = 1.0f / _mass;
+	body.mass = newMass;
+	lastEdit = simulation.editBody(bodyId, [newMass](phys::BodyStore& bodies, size_t i)
+		{
+			bodies.mass()[i] = newMass;
+		});
 }
 
 float Planet::getRadius() const
 {
-	return radius;
+	return body.radius;
 }
 
-DirectX::CXMVECTOR Planet::GetVecVelocity() const
+DirectX::XMVECTOR Planet::GetVecVelocity() const
 {
-	return _vel;
+	return DirectX::XMVectorSet(body.vx, body.vy, body.vz, 0.f);
 }
 
 void Planet::SetVecVelocity(DirectX::CXMVECTOR newVelocity)
 {
-	_vel = newVelocity;
+	DirectX::XMFLOAT3 v;
+	DirectX::XMStoreFloat3(&v, newVelocity);
+	body.vx = v.x;
+	body.vy = v.y;
+	body.vz = v.z;
+	lastEdit = simulation.editBody(bodyId, [v](phys::BodyStore& bodies, size_t i)
+		{
+			bodies.vx()[i] = v.x;
+			bodies.vy()[i] = v.y;
+			bodies.vz()[i] = v.z;
+		});
 }
 
 DirectX::XMFLOAT3 Planet::GetVelocity() const
@@ -60,26 +117,35 @@ void Planet::SetVelocity(const DirectX::XMFLOAT3& newVel)
 
 DirectX::XMVECTOR Planet::calcAcceleration(DirectX::CXMVECTOR force) const
 {
-	return DirectX::XMVectorScale(force, _invMass);
+	return DirectX::XMVectorScale(force, 1.0f / GetMass());
 }
 
 DirectX::XMVECTOR Planet::GetVecPosition() const
 {
-	auto p = GetPosition();
-	return DirectX::XMLoadFloat3(&p);
+	return DirectX::XMVectorSet(body.x, body.y, body.z, 0.f);
 }
 
 void Planet::SetVecPosition(DirectX::CXMVECTOR newPos)
 {
+	// Only the body is updated, the world matrix follows on the next draw
 	DirectX::XMFLOAT3 p;
 	DirectX::XMStoreFloat3(&p, newPos);
-	SetPosition(p);
+	body.x = p.x;
+	body.y = p.y;
+	body.z = p.z;
+	lastEdit = simulation.editBody(bodyId, [p](phys::BodyStore& bodies, size_t i)
+		{
+			bodies.x()[i] = p.x;
+			bodies.y()[i] = p.y;
+			bodies.z()[i] = p.z;
+		});
 }
 
 bool Planet::isRayIntersecting(const Ray& ray) const
 {
 	using namespace DirectX;
 	
+	const float radius = getRadius();
 	XMVECTOR m = ray.origin - GetVecPosition();
 	float b = XMVectorGetX(XMVector3Dot(m, ray.direction));
 	float c = XMVectorGetX(XMVector3Dot(m, m)) - radius * radius;
@@ -96,6 +162,11 @@ bool Planet::isRayIntersecting(const Ray& ray) const
 	return true;
 }
 
+phys::BodyId Planet::GetBodyId() const
+{
+	return bodyId;
+}
+
 void Planet::EnableControlWindow()
 {
 	ControlWindowEnabled = true;
@@ -103,7 +174,6 @@ void Planet::EnableControlWindow()
 
 void Planet::DrawControlWindow()
 {
-	bool outdatedProperties = false;
 	
 	std::string title = "Planet";
 	title.append("##");
@@ -112,9 +182,18 @@ void Planet::DrawControlWindow()
 	ImGui::Begin(title.c_str(), nullptr, ImGuiWindowFlags_AlwaysAutoResize);
 
 	// Position
-	outdatedProperties |= ImGui::DragFloat3("Position", &position.x, 0.25f);
+	DirectX::XMFLOAT3 pos;
+	DirectX::XMStoreFloat3(&pos, GetVecPosition());
+	if (ImGui::DragFloat3("Position", &pos.x, 0.25f))
+	{
+		SetVecPosition(DirectX::XMLoadFloat3(&pos));
+	}
 	// Mass
-	ImGui::InputFloat("Mass", &_mass, 0, 0, "%e");
+	float mass = GetMass();
+	if (ImGui::InputFloat("Mass", &mass, 0, 0, "%e") && mass > 0)
+	{
+		SetMass(mass);
+	}
 	// Velocity
 	auto vel = GetVelocity();
 	if (ImGui::DragFloat3("Velocity", &vel.x, 0.25f))
@@ -129,12 +208,10 @@ void Planet::DrawControlWindow()
 	}
 
 	if(isLogging)
-		Logger::Get().LogWithTime(GetPosition());
+		Logger::Get().LogWithTime(pos);
 	
 
 	ImGui::End();
-	if (outdatedProperties)
-		Sphere::updateCB();
 }
 
 void Planet::DisableControlWindow()
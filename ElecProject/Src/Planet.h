@@ -3,10 +3,14 @@
 // these include:
 // - Construction from radius
 // - Physics properties (mass, vel, ...)
+// The physics properties live in the simulation thread's body store. The
+// planet keeps the last state it saw in a snapshot, its setters update
+// that copy right away and send the change to the simulation.
 //
 
 #pragma once
 #include "Sphere.h"
+#include "SimulationThread.h"
 
 // fwd decl
 struct Ray;
@@ -17,17 +21,32 @@ class Planet :
 public:
     // patternseed is a small float value that makes the random terrain unique to this planet
     Planet(Graphics& gfx,
+        phys::SimulationThread& simulation,
         float patternseed,
         DirectX::XMFLOAT3 pos = { 0,0,0 },
         float radius = 1.0f);
+    // Planet for a whole body description, e.g. one restored from a checkpoint
+    Planet(Graphics& gfx, phys::SimulationThread& simulation, const phys::Body& body);
+    ~Planet();
+    Planet(const Planet&) = delete;
+    Planet& operator=(const Planet&) = delete;
 
+    // Takes the planet's state from the snapshot, unless the snapshot is older than
+    // the planet's own last change. Returns whether the state came from the snapshot.
+    bool Sync(const phys::Snapshot& snapshot);
+    // Whether the body left the simulation, e.g. merged into another one: the snapshot
+    // has seen every change of this planet but not the body
+    bool IsGone(const phys::Snapshot& snapshot) const;
+    // Draws at the last known position
     virtual void Draw(Graphics& gfx) override;
+    // Draws at renderPos instead of the simulated position, e.g. between two physics steps
+    void DrawAt(Graphics& gfx, const DirectX::XMFLOAT3& renderPos);
 
     // Physics Getters and Setters
     float GetMass() const;
     void SetMass(float newMass);
     float getRadius() const;
-    DirectX::CXMVECTOR GetVecVelocity() const;
+    DirectX::XMVECTOR GetVecVelocity() const;
     void SetVecVelocity(DirectX::CXMVECTOR newVelocity);
     DirectX::XMFLOAT3 GetVelocity() const;
     void SetVelocity(const DirectX::XMFLOAT3& newVel);
@@ -36,6 +55,7 @@ public:
     DirectX::XMVECTOR GetVecPosition() const;
     void SetVecPosition(DirectX::CXMVECTOR newPos);
     bool isRayIntersecting(const Ray& ray) const;
+    phys::BodyId GetBodyId() const;
 
     void EnableControlWindow();
     void DrawControlWindow();
@@ -43,12 +63,11 @@ public:
     bool isControlWindowEnabled() const;
     void ToggleControlWindow();
 private:
-    // Physics attributes
-    // units are all SI
-    float _mass = 100.f; 
-    float _invMass = 1.f / _mass;
-    DirectX::XMVECTOR _vel = DirectX::XMVectorZero();
-    const float radius;
+    // Physics attributes (units are all SI) are in the simulation
+    phys::SimulationThread& simulation;
+    phys::BodyId bodyId;
+    phys::Body body; // last known state
+    uint64_t lastEdit = 0; // number of the last command this planet posted, the add at first
 
     bool ControlWindowEnabled = false;
     bool isLogging = false;
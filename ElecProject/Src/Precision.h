@@ -0,0 +1,65 @@
+//
+// Number formats the state of the bodies can be integrated in, picked as
+// a template parameter so the float path compiles to the same code as
+// before. A float has a 24 bit mantissa: near the 500 unit bounding sphere
+// a position only moves in steps of about 3e-5, so slow orbits out there
+// jitter and long runs lose energy.
+// - SinglePrecision: float state and float forces, the fast path
+// - DoublePrecision: double state, the forces summed directly in double
+// - MixedPrecision: double state, the forces in float from the positions
+//   relative to the middle of the system, the direct sum Kahan compensated
+//
+
+#pragma once
+
+namespace phys
+{
+	struct SinglePrecision
+	{
+		using Real = float; // positions and velocities
+		static constexpr bool floatForces = true;
+	};
+
+	struct DoublePrecision
+	{
+		using Real = double;
+		static constexpr bool floatForces = false;
+	};
+
+	struct MixedPrecision
+	{
+		using Real = double;
+		static constexpr bool floatForces = true;
+	};
+
+	// The project builds with /fp:fast, which may rearrange (total + y) - total
+	// to y and drop the compensation
+#ifdef _MSC_VER
+#pragma float_control(precise, on, push)
+#endif
+
+	// Running sum that keeps the rounding error of every addition and adds it
+	// back with the next one (Kahan summation)
+	template<typename Real>
+	class CompensatedSum
+	{
+	public:
+		void add(Real x)
+		{
+			const Real y = x - error;
+			const Real t = total + y;
+			error = (t - total) - y;
+			total = t;
+		}
+
+		Real value() const { return total; }
+
+	private:
+		Real total = 0;
+		Real error = 0;
+	};
+
+#ifdef _MSC_VER
+#pragma float_control(pop)
+#endif
+}
@@ -0,0 +1,431 @@
+#include "Scenario.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <fstream>
+#include <numbers>
+#include <sstream>
+
+namespace
+{
+	using namespace phys;
+	using Generator = Scenario::Generator;
+
+	// SplitMix64 finalizer, spreads neighbouring inputs over all the bits
+	uint64_t mix(uint64_t x)
+	{
+		x += 0x9E3779B97F4A7C15ull;
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+		return x ^ (x >> 31);
+	}
+
+	// Uniform in [0, 1), the stream tells the numbers of the same body apart
+	float uniform(uint64_t seed, uint64_t body, uint64_t stream)
+	{
+		const uint64_t bits = mix(seed ^ mix(body * 8 + stream));
+		return (float)(bits >> 40) * (1.f / (1 << 24));
+	}
+
+	// Terrain seeds in the range the planets always got
+	float terrainSeed(uint64_t seed, uint64_t body)
+	{
+		return -150.f + 300.f * uniform(seed, body, 7);
+	}
+
+	// Point uniform in the unit ball from three uniforms
+	void inBall(float u0, float u1, float u2, float out[3])
+	{
+		const float r = std::cbrt(u0);
+		const float cosTheta = 2.f * u1 - 1.f;
+		const float sinTheta = std::sqrt(std::max(0.f, 1.f - cosTheta * cosTheta));
+		const float phi = 2.f * std::numbers::pi_v<float> * u2;
+		out[0] = r * sinTheta * std::cos(phi);
+		out[1] = r * sinTheta * std::sin(phi);
+		out[2] = r * cosTheta;
+	}
+
+	// Body k of a generator, the same whichever thread makes it
+	Body generateBody(const Generator& g, uint64_t seed, size_t k, float G)
+	{
+		Body b;
+		float p[3] = {}, v[3] = {};
+		b.mass = g.mass;
+		b.radius = g.bodyRadius;
+		switch (g.kind)
+		{
+		case Generator::Kind::Sphere:
+			inBall(uniform(seed, k, 0), uniform(seed, k, 1), uniform(seed, k, 2), p);
+			inBall(uniform(seed, k, 3), uniform(seed, k, 4), uniform(seed, k, 5), v);
+			for (int c = 0; c < 3; ++c)
+			{
+				p[c] *= g.radius;
+				v[c] *= g.speed;
+			}
+			break;
+		case Generator::Kind::Grid:
+		{
+			// Centered on the center, x fastest
+			const size_t i[3] = { k % g.count[0], k / g.count[0] % g.count[1], k / (g.count[0] * g.count[1]) };
+			for (int c = 0; c < 3; ++c)
+				p[c] = ((float)i[c] - 0.5f * (float)(g.count[c] - 1)) * g.spacing;
+			break;
+		}
+		case Generator::Kind::Disk:
+		{
+			if (g.centralMass > 0 && k == 0)
+			{
+				// Same density as the disk bodies
+				b.mass = g.centralMass;
+				b.radius = g.bodyRadius * std::cbrt(g.centralMass / g.mass);
+				break;
+			}
+			// Uniform over the area of the annulus, circular orbits around the central body
+			const float r = std::sqrt(g.inner * g.inner + uniform(seed, k, 0) * (g.outer * g.outer - g.inner * g.inner));
+			const float phi = 2.f * std::numbers::pi_v<float> * uniform(seed, k, 1);
+			const float orbitSpeed = std::sqrt(G * g.centralMass / r);
+			p[0] = r * std::cos(phi);
+			p[1] = r * std::sin(phi);
+			p[2] = g.thickness * (uniform(seed, k, 2) - 0.5f);
+			v[0] = -orbitSpeed * std::sin(phi);
+			v[1] = orbitSpeed * std::cos(phi);
+			break;
+		}
+		}
+		b.x = g.center[0] + p[0];
+		b.y = g.center[1] + p[1];
+		b.z = g.center[2] + p[2];
+		b.vx = g.velocity[0] + v[0];
+		b.vy = g.velocity[1] + v[1];
+		b.vz = g.velocity[2] + v[2];
+		b.seed = terrainSeed(seed, k);
+		return b;
+	}
+
+	// One line split into its keyword, plain values and key=value options
+	struct Line
+	{
+		std::string_view keyword;
+		std::vector<std::string_view> values;
+		std::vector<std::pair<std::string_view, std::string_view>> options;
+	};
+
+	void splitLine(std::string_view text, Line& line)
+	{
+		line.keyword = {};
+		line.values.clear();
+		line.options.clear();
+		size_t pos = 0;
+		while (pos < text.size())
+		{
+			while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t'))
+				++pos;
+			size_t end = pos;
+			while (end < text.size() && text[end] != ' ' && text[end] != '\t')
+				++end;
+			if (end == pos)
+				break;
+			const std::string_view token = text.substr(pos, end - pos);
+			const size_t equals = token.find('=');
+			if (line.keyword.empty())
+				line.keyword = token;
+			else if (equals != std::string_view::npos)
+				line.options.emplace_back(token.substr(0, equals), token.substr(equals + 1));
+			else
+				line.values.push_back(token);
+			pos = end;
+		}
+	}
+
+	template<typename T>
+	bool toNumber(std::string_view text, T& out)
+	{
+		const char* end = text.data() + text.size();
+		const auto result = std::from_chars(text.data(), end, out);
+		return result.ec == std::errc() && result.ptr == end;
+	}
+
+	// Up to n numbers separated by commas, a single number is used for all of them
+	template<typename T>
+	bool toNumbers(std::string_view text, T* out, size_t n)
+	{
+		size_t i = 0;
+		while (i < n)
+		{
+			const size_t comma = text.find(',');
+			if (!toNumber(text.substr(0, comma), out[i++]))
+				return false;
+			if (comma == std::string_view::npos)
+				break;
+			text.remove_prefix(comma + 1);
+			if (i == n)
+				return false;
+		}
+		if (i == 1)
+			std::fill(out + 1, out + n, out[0]);
+		return i == 1 || i == n;
+	}
+
+	// Index of text in names, or -1
+	template<size_t N>
+	int indexOf(std::string_view text, const char* const (&names)[N])
+	{
+		for (size_t i = 0; i < N; ++i)
+		{
+			if (text == names[i])
+				return (int)i;
+		}
+		return -1;
+	}
+
+	const char* const boundaryNames[] = { "sphere", "reflective", "periodic", "none" };
+	const char* const solverNames[] = { "direct", "pairwise", "barnes-hut", "fmm" };
+	const char* const integratorNames[] = { "rk4", "leapfrog", "verlet", "yoshida4", "dopri45", "block" };
+	const char* const precisionNames[] = { "single", "double", "mixed" };
+	const char* const collisionNames[] = { "none", "merge", "elastic" };
+	const char* const switchNames[] = { "off", "on" };
+}
+
+namespace phys
+{
+	size_t Scenario::Generator::bodyCount() const
+	{
+		const size_t n = count[0] * count[1] * count[2];
+		return kind == Kind::Disk && centralMass > 0 ? n + 1 : n;
+	}
+
+	bool Scenario::parse(std::string_view text, std::string& error)
+	{
+		*this = Scenario{};
+		Line line;
+		size_t lineNumber = 0;
+		while (!text.empty())
+		{
+			++lineNumber;
+			const size_t newline = text.find('\n');
+			std::string_view current = text.substr(0, newline);
+			text.remove_prefix(newline == std::string_view::npos ? text.size() : newline + 1);
+			current = current.substr(0, current.find('#'));
+			if (!current.empty() && current.back() == '\r')
+				current.remove_suffix(1);
+			splitLine(current, line);
+			if (line.keyword.empty())
+				continue;
+
+			// Each keyword takes its values and options from the line, anything left is an error
+			std::string problem;
+			auto value = [&](size_t i) { return i < line.values.size() ? line.values[i] : std::string_view(); };
+			auto choice = [&](const auto& names, int& out)
+				{
+					out = indexOf(value(0), names);
+					if (out < 0)
+						problem = "unknown " + std::string(line.keyword) + " '" + std::string(value(0)) + "'";
+					return out >= 0;
+				};
+			auto number = [&](auto& out)
+				{
+					if (!toNumber(value(0), out))
+						problem = std::string(line.keyword) + " needs a number";
+				};
+			size_t valueCount = 1;
+			std::vector<std::pair<std::string_view, std::string_view>> options;
+			options.swap(line.options);
+			// Takes the option key off the list and reads it, returns false when it isn't there
+			auto option = [&](std::string_view key, auto* out, size_t n)
+				{
+					const auto it = std::find_if(options.begin(), options.end(), [key](const auto& o) { return o.first == key; });
+					if (it == options.end())
+						return false;
+					if (!toNumbers(it->second, out, n))
+						problem = "bad value for " + std::string(key);
+					options.erase(it);
+					return true;
+				};
+
+			const std::string_view keyword = line.keyword;
+			int index = 0;
+			Simulation::Settings& s = settings;
+			if (keyword == "G")
+				number(s.G);
+			else if (keyword == "dt")
+				number(dt);
+			else if (keyword == "steps")
+				number(steps);
+			else if (keyword == "seed")
+				number(seed);
+			else if (keyword == "drag")
+				number(s.drag);
+			else if (keyword == "deterministic")
+			{
+				if (choice(switchNames, index))
+					s.deterministic = index == 1;
+			}
+			else if (keyword == "boundary")
+			{
+				if (choice(boundaryNames, index))
+					s.boundary = (Simulation::Boundary)index;
+				option("size", &s.boundarySize, 1);
+				option("restitution", &s.wallRestitution, 1);
+			}
+			else if (keyword == "solver")
+			{
+				if (choice(solverNames, index))
+				{
+					s.gravitySolver = index <= 1 ? Simulation::GravitySolver::Direct : (Simulation::GravitySolver)(index - 1);
+					s.gravityPairwise = index == 1;
+				}
+				option("theta", s.gravitySolver == Simulation::GravitySolver::Fmm ? &s.fmmTheta : &s.barnesHutTheta, 1);
+				option("order", &s.fmmOrder, 1);
+			}
+			else if (keyword == "integrator")
+			{
+				if (choice(integratorNames, index))
+					s.integrator = (Simulation::Integrator)index;
+				option("rtol", &s.relTolerance, 1);
+				option("atol", &s.absTolerance, 1);
+				option("accuracy", &s.blockAccuracy, 1);
+			}
+			else if (keyword == "precision")
+			{
+				if (choice(precisionNames, index))
+					s.precision = (Simulation::Precision)index;
+			}
+			else if (keyword == "collisions")
+			{
+				if (choice(collisionNames, index))
+					s.collisionResponse = (Simulation::CollisionResponse)index;
+				option("restitution", &s.restitution, 1);
+			}
+			else if (keyword == "body")
+			{
+				valueCount = 0;
+				Body b;
+				float p[3] = {}, v[3] = {};
+				option("pos", p, 3);
+				option("vel", v, 3);
+				option("mass", &b.mass, 1);
+				option("radius", &b.radius, 1);
+				option("seed", &b.seed, 1);
+				b.x = p[0]; b.y = p[1]; b.z = p[2];
+				b.vx = v[0]; b.vy = v[1]; b.vz = v[2];
+				// The collision responses divide by both
+				if (!(b.mass > 0 && b.radius > 0))
+					problem = "the mass and radius have to be positive";
+				bodies.push_back(b);
+			}
+			else if (keyword == "sphere" || keyword == "grid" || keyword == "disk")
+			{
+				valueCount = 0;
+				Generator g;
+				g.kind = keyword == "sphere" ? Generator::Kind::Sphere : keyword == "grid" ? Generator::Kind::Grid : Generator::Kind::Disk;
+				// A grid takes a count per axis, a single count is a cube
+				if (!option("count", g.count, g.kind == Generator::Kind::Grid ? 3 : 1))
+					problem = std::string(keyword) + " needs a count";
+				option("center", g.center, 3);
+				option("velocity", g.velocity, 3);
+				option("mass", &g.mass, 1);
+				option("bodyRadius", &g.bodyRadius, 1);
+				g.seeded = option("seed", &g.seed, 1);
+				if (g.kind == Generator::Kind::Sphere)
+				{
+					option("radius", &g.radius, 1);
+					option("speed", &g.speed, 1);
+				}
+				else if (g.kind == Generator::Kind::Grid)
+				{
+					option("spacing", &g.spacing, 1);
+				}
+				else
+				{
+					option("inner", &g.inner, 1);
+					option("outer", &g.outer, 1);
+					option("thickness", &g.thickness, 1);
+					option("central", &g.centralMass, 1);
+				}
+				if (g.kind != Generator::Kind::Grid)
+					g.count[1] = g.count[2] = 1;
+				// A factor at a time, the whole product could wrap around
+				if (problem.empty() && (g.count[0] >= BodyStore::InvalidIndex || g.count[1] >= BodyStore::InvalidIndex ||
+					g.count[2] >= BodyStore::InvalidIndex || g.count[0] * g.count[1] >= BodyStore::InvalidIndex))
+					problem = "too many bodies";
+				if (problem.empty() && !(g.mass > 0 && g.bodyRadius > 0))
+					problem = "the mass and bodyRadius have to be positive";
+				if (problem.empty() && g.kind == Generator::Kind::Disk && !(g.inner > 0 && g.outer >= g.inner))
+					problem = "a disk needs 0 < inner <= outer";
+				generators.push_back(g);
+			}
+			else
+			{
+				problem = "unknown keyword '" + std::string(keyword) + "'";
+			}
+
+			if (problem.empty() && line.values.size() > valueCount)
+				problem = "too many values";
+			if (problem.empty() && line.values.size() < valueCount)
+				problem = std::string(keyword) + " needs a value";
+			if (problem.empty() && !options.empty())
+				problem = "unknown option '" + std::string(options.front().first) + "' for " + std::string(keyword);
+			if (!problem.empty())
+			{
+				error = "line " + std::to_string(lineNumber) + ": " + problem;
+				return false;
+			}
+		}
+		// The body count has to fit the ids
+		if (bodyCount() >= BodyStore::InvalidIndex)
+		{
+			error = "too many bodies";
+			return false;
+		}
+		return true;
+	}
+
+	bool Scenario::load(const std::string& path, std::string& error)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file)
+		{
+			error = "Can't open " + path;
+			return false;
+		}
+		std::ostringstream text;
+		text << file.rdbuf();
+		if (!parse(text.str(), error))
+		{
+			error = path + " " + error;
+			return false;
+		}
+		return true;
+	}
+
+	size_t Scenario::bodyCount() const
+	{
+		size_t n = bodies.size();
+		for (const Generator& g : generators)
+			n += g.bodyCount();
+		return n;
+	}
+
+	void Scenario::generate(BodyStore& store) const
+	{
+		store.clear();
+		size_t first = store.append(bodyCount());
+		for (size_t i = 0; i < bodies.size(); ++i)
+			store.set(first + i, bodies[i]);
+		first += bodies.size();
+
+		for (size_t gi = 0; gi < generators.size(); ++gi)
+		{
+			const Generator& g = generators[gi];
+			const uint64_t generatorSeed = g.seeded ? g.seed : mix(seed + gi);
+			const size_t n = g.bodyCount();
+			parallelFor(n, generateGrain, [&](size_t begin, size_t end)
+				{
+					for (size_t k = begin; k < end; ++k)
+						store.set(first + k, generateBody(g, generatorSeed, k, settings.G));
+				});
+			first += n;
+		}
+	}
+}
@@ -0,0 +1,91 @@
+//
+// Initial conditions and settings of a run, read from a text file. Each
+// line is a keyword followed by values or key=value pairs, # starts a
+// comment:
+//
+//   G 1
+//   boundary sphere size=500          (sphere, reflective, periodic, none; restitution=)
+//   solver fmm order=4 theta=0.5      (direct, pairwise, barnes-hut, fmm)
+//   integrator leapfrog               (rk4, leapfrog, verlet, yoshida4, dopri45, block)
+//   precision single                  (single, double, mixed)
+//   collisions elastic restitution=0.5 (none, merge, elastic)
+//   drag 0
+//   deterministic on
+//   dt 0.0083333
+//   steps 1000
+//   seed 42
+//   body pos=0,0,0 vel=0,0,5 mass=1000 radius=16 seed=-1
+//   sphere count=1000000 radius=400 mass=1e-5 bodyRadius=0.5 speed=1
+//   grid count=20,20,20 spacing=10 mass=1e-5 bodyRadius=2
+//   disk count=5000 inner=50 outer=300 thickness=5 mass=1e-4 bodyRadius=1 central=1000
+//
+// The generators also take center=, velocity= and seed=. A generator
+// without a seed gets one from the scenario's seed and its position in
+// the file. Every body's random numbers come from a hash of the seed and
+// the body's number instead of a sequence, so the bodies are generated in
+// parallel and come out the same on any number of threads.
+//
+
+#pragma once
+#include "BodyStore.h"
+#include "Simulation.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace phys
+{
+	class Scenario
+	{
+	public:
+		// A procedural set of bodies, see the kinds above
+		struct Generator
+		{
+			enum class Kind
+			{
+				Sphere, // uniform in a ball, random velocities up to speed
+				Grid, // lattice of count[0] x count[1] x count[2] points spacing apart
+				Disk // annulus in the xy plane on circular orbits around a central body
+			};
+
+			Kind kind = Kind::Sphere;
+			size_t count[3] = { 0, 1, 1 };
+			float center[3] = {};
+			float velocity[3] = {};
+			float radius = 100.f; // Sphere
+			float speed = 0.f; // Sphere
+			float spacing = 10.f; // Grid
+			float inner = 10.f, outer = 100.f, thickness = 0.f; // Disk
+			float centralMass = 0.f; // Disk, the central body is left out when 0
+			float mass = 1.f;
+			float bodyRadius = 1.f;
+			uint64_t seed = 0;
+			bool seeded = false; // seed was given, otherwise it comes from the scenario's
+
+			size_t bodyCount() const;
+		};
+
+	public:
+		// Replaces this scenario with the one in the text, returns false with the line
+		// and the reason in error when it can't be read
+		bool parse(std::string_view text, std::string& error);
+		bool load(const std::string& path, std::string& error);
+
+		// Bodies the scenario makes
+		size_t bodyCount() const;
+		// Replaces the bodies of the store with the ones of the scenario, explicit
+		// bodies first, then each generator in the order of the file
+		void generate(BodyStore& bodies) const;
+
+		Simulation::Settings settings;
+		float dt = 1.f / 120.f;
+		long long steps = 1000;
+		uint64_t seed = 1;
+		std::vector<Body> bodies;
+		std::vector<Generator> generators;
+
+	private:
+		static constexpr size_t generateGrain = 4096; // bodies per task
+	};
+}
@@ -0,0 +1,48 @@
+#include "ScratchArena.h"
+#include <algorithm>
+#include <new>
+
+namespace phys
+{
+	ScratchArena::~ScratchArena()
+	{
+		for (const Block& b : blocks)
+			::operator delete(b.data, std::align_val_t(Alignment));
+	}
+
+	void ScratchArena::reset()
+	{
+		// Last step didn't fit in one block, replace them with one that holds all of it
+		if (blocks.size() > 1)
+		{
+			const size_t size = stepBytes;
+			for (const Block& b : blocks)
+				::operator delete(b.data, std::align_val_t(Alignment));
+			blocks.clear();
+			blocks.push_back({ static_cast<std::byte*>(::operator new(size, std::align_val_t(Alignment))), size });
+		}
+		used = 0;
+		stepBytes = 0;
+	}
+
+	size_t ScratchArena::capacity() const
+	{
+		return blocks.empty() ? 0 : blocks.back().size - used;
+	}
+
+	void* ScratchArena::allocateBytes(size_t bytes)
+	{
+		bytes = std::max<size_t>(Alignment, (bytes + Alignment - 1) / Alignment * Alignment);
+		if (blocks.empty() || blocks.back().size - used < bytes)
+		{
+			// Chain on a new block, the old ones stay valid until the reset
+			const size_t size = std::max({ bytes, blocks.empty() ? 0 : 2 * blocks.back().size, size_t(64) << 10 });
+			blocks.push_back({ static_cast<std::byte*>(::operator new(size, std::align_val_t(Alignment))), size });
+			used = 0;
+		}
+		void* p = blocks.back().data + used;
+		used += bytes;
+		stepBytes += bytes;
+		return p;
+	}
+}
@@ -0,0 +1,52 @@
+//
+// Bump allocator for the temporary arrays of a physics step.
+// Everything handed out lives until the next reset. When a step needs
+// more than the arena holds, extra blocks are chained on and merged into
+// one big block at the next reset, so a step of the same size as the
+// previous ones never touches the heap.
+//
+
+#pragma once
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+namespace phys
+{
+	class ScratchArena
+	{
+	public:
+		static constexpr size_t Alignment = 64;
+
+		ScratchArena() = default;
+		~ScratchArena();
+		ScratchArena(const ScratchArena&) = delete;
+		ScratchArena& operator=(const ScratchArena&) = delete;
+
+		// Uninitialized, 64 byte aligned memory for count objects, valid until the next reset
+		template<typename T>
+		T* allocate(size_t count)
+		{
+			static_assert(std::is_trivially_destructible_v<T>, "The arena never runs destructors");
+			static_assert(alignof(T) <= Alignment);
+			return static_cast<T*>(allocateBytes(count * sizeof(T)));
+		}
+		// Releases everything handed out since the last reset
+		void reset();
+		// Bytes the arena can hand out before it has to allocate
+		size_t capacity() const;
+
+	private:
+		void* allocateBytes(size_t bytes);
+
+	private:
+		struct Block
+		{
+			std::byte* data;
+			size_t size;
+		};
+		std::vector<Block> blocks; // the last one is being filled
+		size_t used = 0; // bytes used in the last block
+		size_t stepBytes = 0; // bytes handed out since the last reset (with padding)
+	};
+}
@@ -0,0 +1,326 @@
+#include "Simulation.h"
+#include "AllocationCounter.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <type_traits>
+
+namespace phys
+{
+	void Simulation::setSettings(const Settings& newSettings)
+	{
+		// Anything that changes the forces makes the stored accelerations stale
+		if (newSettings.G != settings.G
+			|| newSettings.boundary != settings.boundary
+			|| newSettings.boundarySize != settings.boundarySize
+			|| newSettings.drag != settings.drag
+			|| newSettings.gravitySolver != settings.gravitySolver
+			|| newSettings.barnesHutTheta != settings.barnesHutTheta
+			|| newSettings.barnesHutQuadrupole != settings.barnesHutQuadrupole
+			|| newSettings.fmmOrder != settings.fmmOrder
+			|| newSettings.fmmTheta != settings.fmmTheta)
+		{
+			accelerationCache.invalidate();
+			wideAccelerationCache.invalidate();
+		}
+		settings = newSettings;
+		dormandPrince.setTolerance(settings.relTolerance, settings.absTolerance);
+		blockTimesteps.setAccuracy(settings.blockAccuracy);
+	}
+
+	void Simulation::step(float dt)
+	{
+		// This thread and the pool's workers, not the rendering that allocates in parallel
+		ThreadAllocationScope allocationScope;
+		const size_t workerAllocations = ThreadPool::get().workerAllocationCount();
+		stepScratch.reset();
+		gravitySeconds = 0;
+		gravityInteractions = 0;
+
+		switch (settings.precision)
+		{
+		case Precision::Single:
+			stepWith<SinglePrecision>(dt);
+			break;
+		case Precision::Double:
+			stepWith<DoublePrecision>(dt);
+			break;
+		case Precision::Mixed:
+			stepWith<MixedPrecision>(dt);
+			break;
+		}
+
+		// Bodies merged away are removed from the store, the arrays stay compact
+		stats.collisions = {};
+		if (settings.collisionResponse == CollisionResponse::Merge)
+		{
+			collisionMerger.mergeTouching(bodies);
+			stats.collisions = collisionMerger.getStats();
+		}
+		else if (settings.collisionResponse == CollisionResponse::Elastic)
+		{
+			elasticCollisions.resolve(bodies, settings.restitution);
+			stats.collisions = elasticCollisions.getStats();
+		}
+
+		stats.diagnostics = settings.measureDiagnostics ? diagnosticsMeter.measure(bodies, settings.G, settings.exactPotential) : Diagnostics{};
+
+		if (settings.gravitySolver == GravitySolver::Direct || settings.precision == Precision::Double)
+			stats.interactionsPerSec = gravitySeconds > 0 ? (float)(gravityInteractions / gravitySeconds) : 0.f;
+		stats.dormandPrince = dormandPrince.getStats();
+		stats.blockTimesteps = blockTimesteps.getStats();
+		stats.allocations = allocationScope.allocations() + (ThreadPool::get().workerAllocationCount() - workerAllocations);
+	}
+
+	template<typename Mode>
+	void Simulation::stepWith(float dt)
+	{
+		using Real = typename Mode::Real;
+		const size_t n = bodies.size();
+		const float* masses = bodies.mass();
+		Real* pos[3];
+		Real* vel[3];
+		BasicAccelerationCache<Real>* cache;
+		if constexpr (std::is_same_v<Real, float>)
+		{
+			pos[0] = bodies.x(); pos[1] = bodies.y(); pos[2] = bodies.z();
+			vel[0] = bodies.vx(); vel[1] = bodies.vy(); vel[2] = bodies.vz();
+			cache = &accelerationCache;
+		}
+		else
+		{
+			loadWideState();
+			for (int c = 0; c < 3; ++c)
+			{
+				pos[c] = widePositions[c].data();
+				vel[c] = wideVelocities[c].data();
+			}
+			cache = &wideAccelerationCache;
+		}
+
+		auto computeAccel = [this](const Real* const p[3], const Real* const v[3], Real* const a[3])
+			{
+				computeAccelerations<Mode>(nullptr, bodies.size(), p, v, a);
+			};
+
+		switch (settings.integrator)
+		{
+		case Integrator::RK4:
+			integrateSystem<RK4>(pos, vel, masses, n, dt, stepScratch, *cache, computeAccel);
+			break;
+		case Integrator::Leapfrog:
+			integrateSystem<Leapfrog>(pos, vel, masses, n, dt, stepScratch, *cache, computeAccel);
+			break;
+		case Integrator::VelocityVerlet:
+			integrateSystem<VelocityVerlet>(pos, vel, masses, n, dt, stepScratch, *cache, computeAccel);
+			break;
+		case Integrator::Yoshida4:
+			integrateSystem<Yoshida4>(pos, vel, masses, n, dt, stepScratch, *cache, computeAccel);
+			break;
+		case Integrator::DormandPrince45:
+			// Covers the frame time with as many steps as the tolerance asks for
+			dormandPrince.advance(pos, vel, masses, n, dt, stepScratch, *cache, computeAccel);
+			break;
+		case Integrator::BlockTimesteps:
+			// Only the bodies that end one of their own steps get their forces evaluated
+			blockTimesteps.advance(pos, vel, masses, bodies.radius(), n, dt, stepScratch, *cache,
+				[this](const uint32_t* active, size_t count, const Real* const p[3], const Real* const v[3], Real* const a[3])
+				{
+					computeAccelerations<Mode>(active, count, p, v, a);
+				});
+			break;
+		}
+
+		// The walls and the periodic box move the bodies directly, the sphere is a force
+		if (settings.boundary == Boundary::ReflectiveBox)
+			applyBoundary(ReflectiveBox{ settings.boundarySize, settings.wallRestitution }, pos, vel, n);
+		else if (settings.boundary == Boundary::PeriodicBox)
+			applyBoundary(PeriodicBox{ settings.boundarySize }, pos, vel, n);
+
+		if constexpr (!std::is_same_v<Real, float>)
+			storeWideState();
+	}
+
+	void Simulation::loadWideState()
+	{
+		// A body whose floats are no longer its rounded double state was added, edited
+		// or moved to another index by a removal since the last step
+		const size_t n = bodies.size();
+		const size_t kept = std::min(wideIds.size(), n);
+		const float* const pos[3] = { bodies.x(), bodies.y(), bodies.z() };
+		const float* const vel[3] = { bodies.vx(), bodies.vy(), bodies.vz() };
+		wideIds.resize(n);
+		for (int c = 0; c < 3; ++c)
+		{
+			widePositions[c].resize(n);
+			wideVelocities[c].resize(n);
+		}
+		for (size_t i = 0; i < n; ++i)
+		{
+			bool same = i < kept && wideIds[i] == bodies.idAt(i);
+			for (int c = 0; c < 3; ++c)
+				same = same && (float)widePositions[c][i] == pos[c][i] && (float)wideVelocities[c][i] == vel[c][i];
+			if (same)
+				continue;
+			for (int c = 0; c < 3; ++c)
+			{
+				widePositions[c][i] = pos[c][i];
+				wideVelocities[c][i] = vel[c][i];
+			}
+			wideIds[i] = bodies.idAt(i);
+		}
+	}
+
+	void Simulation::storeWideState()
+	{
+		float* const pos[3] = { bodies.x(), bodies.y(), bodies.z() };
+		float* const vel[3] = { bodies.vx(), bodies.vy(), bodies.vz() };
+		for (int c = 0; c < 3; ++c)
+		{
+			for (size_t i = 0; i < bodies.size(); ++i)
+			{
+				pos[c][i] = (float)widePositions[c][i];
+				vel[c][i] = (float)wideVelocities[c][i];
+			}
+		}
+	}
+
+	template<typename Mode, typename Real>
+	void Simulation::computeAccelerations(const uint32_t* active, size_t count, const Real* const p[3], const Real* const v[3], Real* const a[3])
+	{
+		// Gravity between the bodies, then one pass that clamps it and adds the
+		// push back into the bounding sphere and the drag. Without the sphere
+		// its radius is infinite, so it never pushes.
+		const float sphereRadius = settings.boundary == Boundary::Sphere ? settings.boundarySize : std::numeric_limits<float>::infinity();
+		const BasicForceBatch<Real> batch(bodies.size(), p, v, bodies.mass(), active, count);
+		const BatchForce gravity{ [this](const BasicForceBatch<Real>& b, Real* const acc[3])
+			{
+				if constexpr (!Mode::floatForces)
+					computeGravityDouble(b, acc);
+				else if constexpr (!std::is_same_v<Real, float>)
+					computeGravityMixed(b, acc);
+				else if (settings.gravitySolver == GravitySolver::Direct)
+					computeGravityDirect(b, acc);
+				else
+					computeGravityTree(b, acc);
+			} };
+		const ForceSet forces(gravity, AccelerationLimit{}, BoundingSphere{ sphereRadius }, Drag{ settings.drag });
+		forces.evaluate(batch, a);
+	}
+
+	void Simulation::computeGravityDirect(const ForceBatch& batch, float* const a[3])
+	{
+		// One batched kernel call over all bodies
+		const auto start = std::chrono::steady_clock::now();
+		DirectGravity{ settings.G, settings.gravityPairwise, settings.deterministic }.compute(batch, a);
+		const std::chrono::duration<float> gravityTime = std::chrono::steady_clock::now() - start;
+		gravitySeconds += gravityTime.count();
+		gravityInteractions += (double)batch.count * batch.n;
+	}
+
+	void Simulation::computeGravityDouble(const BasicForceBatch<double>& batch, double* const a[3])
+	{
+		const auto start = std::chrono::steady_clock::now();
+		ForceSet(Gravity{ settings.G }).evaluate(batch, a);
+		const std::chrono::duration<float> gravityTime = std::chrono::steady_clock::now() - start;
+		gravitySeconds += gravityTime.count();
+		gravityInteractions += (double)batch.count * batch.n;
+	}
+
+	void Simulation::computeGravityMixed(const BasicForceBatch<double>& batch, double* const a[3])
+	{
+		// Relative to the middle of the bounding box the floats spend their digits on
+		// the distances between the bodies instead of the distance to the origin
+		const size_t n = batch.n;
+		const size_t count = batch.count;
+		double middle[3] = {};
+		for (int c = 0; c < 3 && n > 0; ++c)
+		{
+			const auto [lo, hi] = std::minmax_element(batch.pos[c], batch.pos[c] + n);
+			middle[c] = 0.5 * (*lo + *hi);
+		}
+		mixedPositions.resize(3 * n);
+		mixedAccelerations.resize(3 * count);
+		float* const p[3] = { mixedPositions.data(), mixedPositions.data() + n, mixedPositions.data() + 2 * n };
+		float* const acc[3] = { mixedAccelerations.data(), mixedAccelerations.data() + count, mixedAccelerations.data() + 2 * count };
+		for (int c = 0; c < 3; ++c)
+			for (size_t i = 0; i < n; ++i)
+				p[c][i] = (float)(batch.pos[c][i] - middle[c]);
+
+		// Gravity doesn't read the velocities
+		const ForceBatch relative(n, p, nullptr, batch.mass, batch.active, count);
+		if (settings.gravitySolver == GravitySolver::Direct)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			ForceSet(Gravity{ settings.G, true }).evaluate(relative, acc);
+			const std::chrono::duration<float> gravityTime = std::chrono::steady_clock::now() - start;
+			gravitySeconds += gravityTime.count();
+			gravityInteractions += (double)count * n;
+		}
+		else
+		{
+			computeGravityTree(relative, acc);
+		}
+		for (int c = 0; c < 3; ++c)
+			for (size_t k = 0; k < count; ++k)
+				a[c][k] = acc[c][k];
+	}
+
+	void Simulation::computeGravityTree(const ForceBatch& batch, float* const a[3])
+	{
+		// The trees take their input as vectors, those keep their capacity between steps.
+		// The tree is rebuilt from all bodies at every force evaluation.
+		const size_t n = batch.n;
+		const float* const* p = batch.pos;
+		const uint32_t* active = batch.active;
+		const size_t count = batch.count;
+		treeStates.resize(n);
+		treeMasses.assign(batch.mass, batch.mass + n);
+		for (size_t i = 0; i < n; ++i)
+			treeStates[i].position = DirectX::XMVectorSet(p[0][i], p[1][i], p[2][i], 0.f);
+
+		if (settings.gravitySolver == GravitySolver::BarnesHut)
+		{
+			bhTree.build(treeStates, treeMasses);
+			// The tree walks only read the tree, each body is independent
+			parallelFor(count, treeQueryGrain, [&](size_t begin, size_t end)
+				{
+					for (size_t k = begin; k < end; ++k)
+					{
+						const size_t i = active ? active[k] : k;
+						DirectX::XMFLOAT3 acc;
+						DirectX::XMStoreFloat3(&acc, bhTree.computeAcceleration(treeStates[i].position, i, settings.G, settings.barnesHutTheta, settings.barnesHutQuadrupole));
+						a[0][k] = acc.x; a[1][k] = acc.y; a[2][k] = acc.z;
+					}
+				});
+		}
+		else
+		{
+			fmmSolver.setOrder(settings.fmmOrder);
+			fmmSolver.setTheta(settings.fmmTheta);
+			fmmSolver.build(treeStates, treeMasses, settings.G);
+			if (active)
+			{
+				parallelFor(count, treeQueryGrain, [&](size_t begin, size_t end)
+					{
+						for (size_t k = begin; k < end; ++k)
+						{
+							DirectX::XMFLOAT3 acc;
+							DirectX::XMStoreFloat3(&acc, fmmSolver.computeAcceleration(treeStates[active[k]].position, active[k]));
+							a[0][k] = acc.x; a[1][k] = acc.y; a[2][k] = acc.z;
+						}
+					});
+			}
+			else
+			{
+				fmmSolver.computeAccelerations(treeAccelerations);
+				for (size_t k = 0; k < count; ++k)
+				{
+					const DirectX::XMFLOAT3& acc = treeAccelerations[k];
+					a[0][k] = acc.x; a[1][k] = acc.y; a[2][k] = acc.z;
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,174 @@
+//
+// The physics of the bodies without any rendering or input: the body
+// store, the gravity solvers, the integrators and everything they keep
+// between steps. Only one thread may use a simulation at a time.
+//
+
+#pragma once
+#include "BodyStore.h"
+#include "PhysEngine.h"
+#include "FmmSolver.h"
+#include "ScratchArena.h"
+#include "Integrators.h"
+#include "ForceTerms.h"
+#include "Precision.h"
+#include "Collisions.h"
+#include "Boundaries.h"
+#include "Diagnostics.h"
+#include <vector>
+
+namespace phys
+{
+	class Simulation
+	{
+	public:
+		// Which solver computes the gravitational pull between bodies
+		enum class GravitySolver
+		{
+			Direct,
+			BarnesHut,
+			Fmm
+		};
+
+		// Which method advances the bodies
+		enum class Integrator
+		{
+			RK4,
+			Leapfrog,
+			VelocityVerlet,
+			Yoshida4,
+			DormandPrince45,
+			BlockTimesteps
+		};
+
+		// Number format the bodies are integrated in, see Precision.h
+		enum class Precision
+		{
+			Single,
+			Double,
+			Mixed
+		};
+
+		// What keeps the bodies together, see Boundaries.h
+		enum class Boundary
+		{
+			Sphere, // pulled back by a spring with a damper
+			ReflectiveBox,
+			PeriodicBox,
+			None
+		};
+
+		// What happens to bodies that touch
+		enum class CollisionResponse
+		{
+			None, // they pass through each other
+			Merge,
+			Elastic // they bounce off each other
+		};
+
+		struct Settings
+		{
+			float G = 1.f;
+			Boundary boundary = Boundary::Sphere;
+			float boundarySize = 500.f; // radius of the sphere, half the side of the boxes
+			float wallRestitution = 1.f; // Reflective box
+			float drag = 0.f; // linear drag coefficient, 1/s
+			GravitySolver gravitySolver = GravitySolver::Direct;
+			bool gravityPairwise = false; // Direct sum evaluates each pair once for both bodies
+			bool deterministic = false; // Bitwise the same trajectories on any number of threads
+			float barnesHutTheta = 0.5f; // opening angle
+			bool barnesHutQuadrupole = true;
+			int fmmOrder = 4;
+			float fmmTheta = 0.5f;
+			Integrator integrator = Integrator::RK4;
+			float relTolerance = 1e-5f; // Dormand-Prince
+			float absTolerance = 1e-5f;
+			float blockAccuracy = 0.02f; // Block time steps
+			Precision precision = Precision::Single; // Double sums gravity directly whatever the solver
+			CollisionResponse collisionResponse = CollisionResponse::None;
+			float restitution = 0.5f; // Elastic collisions, 1 keeps the kinetic energy
+			bool measureDiagnostics = true; // Conserved quantities after every step
+			bool exactPotential = false; // Every pair for the potential energy instead of a sample
+		};
+
+		struct Stats
+		{
+			size_t allocations = 0; // Heap allocations made by the last step, on the simulation thread and the pool's workers
+			float interactionsPerSec = 0; // Throughput of the direct sum during the last step
+			DormandPrince45::Stats dormandPrince;
+			BlockTimesteps::Stats blockTimesteps;
+			CollisionStats collisions;
+			Diagnostics diagnostics; // Measured at the end of the last step
+		};
+
+	public:
+		Simulation() = default;
+		Simulation(const Simulation&) = delete;
+		Simulation& operator=(const Simulation&) = delete;
+
+		void setSettings(const Settings& newSettings);
+		const Settings& getSettings() const { return settings; }
+		const Stats& getStats() const { return stats; }
+		BodyStore& getBodies() { return bodies; }
+		const BodyStore& getBodies() const { return bodies; }
+
+		// Advances every body by dt with the selected integrator, then resolves the contacts
+		void step(float dt);
+
+	private:
+		// Runs the selected integrator on the state in the number format of Mode
+		template<typename Mode>
+		void stepWith(float dt);
+		// The double state of the double and mixed modes lives next to the float body
+		// store. Load takes over the bodies that were added or edited since the last
+		// step, store rounds the state back for everything else that reads the bodies.
+		void loadWideState();
+		void storeWideState();
+		// Acceleration of the bodies active[0..count) at positions p, written to a[c][k] for
+		// body active[k]. A null active list means every body.
+		template<typename Mode, typename Real>
+		void computeAccelerations(const uint32_t* active, size_t count, const Real* const p[3], const Real* const v[3], Real* const a[3]);
+		// Gravitational acceleration with the batched direct sum kernel
+		void computeGravityDirect(const ForceBatch& batch, float* const a[3]);
+		// Gravitational acceleration summed directly in double
+		void computeGravityDouble(const BasicForceBatch<double>& batch, double* const a[3]);
+		// Gravitational acceleration in float from the positions relative to the middle of
+		// the bodies, with the compensated direct sum or one of the tree solvers
+		void computeGravityMixed(const BasicForceBatch<double>& batch, double* const a[3]);
+		// Gravitational acceleration with one of the tree solvers
+		void computeGravityTree(const ForceBatch& batch, float* const a[3]);
+
+	private:
+		static constexpr size_t treeQueryGrain = 64; // bodies per task when walking the trees in parallel
+
+	private:
+		Settings settings;
+		Stats stats;
+		BodyStore bodies;
+
+		BarnesHutTree bhTree;
+		FmmSolver fmmSolver;
+		AccelerationCache accelerationCache; // Accelerations the leapfrog, Verlet, Dormand-Prince and block steps reuse
+		BasicAccelerationCache<double> wideAccelerationCache; // The same for the double state
+		DormandPrince45 dormandPrince;
+		BlockTimesteps blockTimesteps;
+		CollisionMerger collisionMerger;
+		ElasticCollisions elasticCollisions;
+		DiagnosticsMeter diagnosticsMeter;
+		float gravitySeconds = 0; // Time spent in the direct sum kernel during the current step
+		double gravityInteractions = 0; // Pairs the direct sum kernel evaluated during the current step
+
+		// Temporary arrays of a step, kept between steps so the steady state doesn't allocate
+		ScratchArena stepScratch;
+		std::vector<State> treeStates;
+		std::vector<float> treeMasses;
+		std::vector<DirectX::XMFLOAT3> treeAccelerations;
+		std::vector<float> mixedPositions; // x, y, z blocks relative to the middle of the bodies
+		std::vector<float> mixedAccelerations;
+
+		// Double state of the double and mixed modes, per body index, and the ids it belongs to
+		std::vector<double> widePositions[3];
+		std::vector<double> wideVelocities[3];
+		std::vector<BodyId> wideIds;
+	};
+}
@@ -0,0 +1,209 @@
+#include "SimulationThread.h"
+#include <algorithm>
+
+namespace phys
+{
+	SimulationThread::SimulationThread()
+		:
+		thread([this]() { run(); })
+	{
+	}
+
+	SimulationThread::~SimulationThread()
+	{
+		{
+			std::lock_guard lock(commandMutex);
+			stopping = true;
+		}
+		commandPosted.notify_one();
+		thread.join();
+	}
+
+	uint64_t SimulationThread::post(Command command)
+	{
+		uint64_t number;
+		{
+			std::lock_guard lock(commandMutex);
+			pendingCommands.push_back(std::move(command));
+			number = ++postedCount;
+		}
+		commandPosted.notify_one();
+		return number;
+	}
+
+	BodyId SimulationThread::addBody(const Body& body, uint64_t* command)
+	{
+		// Ids aren't reused, so an old snapshot never shows another body under a new planet's id
+		const BodyId id = nextBodyId++;
+		const uint64_t number = post([id, body](Simulation& sim) { sim.getBodies().add(body, id); });
+		if (command)
+			*command = number;
+		return id;
+	}
+
+	void SimulationThread::removeBody(BodyId id)
+	{
+		post([id](Simulation& sim)
+			{
+				BodyStore& bodies = sim.getBodies();
+				if (bodies.contains(id))
+					bodies.remove(id);
+			});
+	}
+
+	void SimulationThread::setSettings(const Simulation::Settings& settings)
+	{
+		post([settings](Simulation& sim) { sim.setSettings(settings); });
+	}
+
+	void SimulationThread::setSimulatedTime(float time)
+	{
+		post([this, time](Simulation&) { simulatedTime = time; });
+	}
+
+	void SimulationThread::setEnabled(bool enable)
+	{
+		post([this, enable](Simulation&)
+			{
+				// Don't catch up on the time spent paused
+				if (enable && !enabled)
+				{
+					clock.Reset();
+					timer.Mark();
+				}
+				enabled = enable;
+			});
+	}
+
+	void SimulationThread::setFixedTimestep(bool enable)
+	{
+		post([this, enable](Simulation&) { fixedTimestep = enable; });
+	}
+
+	void SimulationThread::setRate(float rate)
+	{
+		post([this, rate](Simulation&) { clock.SetRate(rate); });
+	}
+
+	void SimulationThread::setMaxSubsteps(int maxSubsteps)
+	{
+		post([this, maxSubsteps](Simulation&) { clock.SetMaxSubsteps(maxSubsteps); });
+	}
+
+	const Snapshot& SimulationThread::latest()
+	{
+		return snapshots.acquire();
+	}
+
+	void SimulationThread::run()
+	{
+		for (;;)
+		{
+			{
+				// Sleep until the next fixed step is due or something is posted. With
+				// variable steps the thread steps again right away.
+				std::unique_lock lock(commandMutex);
+				auto wake = [this]() { return stopping || !pendingCommands.empty(); };
+				if (!enabled)
+					commandPosted.wait(lock, wake);
+				else if (fixedTimestep)
+					commandPosted.wait_for(lock, std::chrono::duration<float>(clock.GetStep() * (1.f - clock.GetAlpha())), wake);
+				if (stopping)
+					return;
+				runningCommands.swap(pendingCommands);
+			}
+
+			const bool changed = !runningCommands.empty();
+			for (auto& command : runningCommands)
+				command(simulation);
+			appliedCount += runningCommands.size();
+			runningCommands.clear();
+
+			// While running, changes go out with the next step
+			if (enabled)
+			{
+				if (stepDue())
+					publish(fixedTimestep ? clock.GetStep() : 0.f);
+			}
+			else if (changed)
+			{
+				publish(0.f);
+			}
+		}
+	}
+
+	bool SimulationThread::stepDue()
+	{
+		const float elapsed = timer.Mark();
+		if (!fixedTimestep)
+		{
+			// Straight from the elapsed time, drawn where the step left the bodies
+			previousIds.clear();
+			simulation.step(elapsed);
+			simulatedTime += elapsed;
+			return true;
+		}
+
+		// Fixed steps only, the last two states are drawn interpolated
+		const int steps = clock.Advance(elapsed);
+		for (int s = 0; s < steps; ++s)
+		{
+			if (s == steps - 1)
+				capturePreviousState();
+			simulation.step(clock.GetStep());
+			simulatedTime += clock.GetStep();
+		}
+		return steps > 0;
+	}
+
+	void SimulationThread::capturePreviousState()
+	{
+		const BodyStore& bodies = simulation.getBodies();
+		const size_t n = bodies.size();
+		previousPositions.resize(3 * n);
+		previousIds.resize(n);
+		std::copy(bodies.x(), bodies.x() + n, previousPositions.begin());
+		std::copy(bodies.y(), bodies.y() + n, previousPositions.begin() + n);
+		std::copy(bodies.z(), bodies.z() + n, previousPositions.begin() + 2 * n);
+		for (size_t i = 0; i < n; ++i)
+			previousIds[i] = bodies.idAt(i);
+	}
+
+	void SimulationThread::publish(float interpolationStep)
+	{
+		// The vectors of the slot keep their capacity, so this doesn't allocate once the body count settles
+		Snapshot& snapshot = snapshots.back();
+		const BodyStore& bodies = simulation.getBodies();
+		const size_t n = bodies.size();
+		const size_t m = previousIds.size();
+
+		snapshot.commandsApplied = appliedCount;
+		snapshot.time = std::chrono::steady_clock::now();
+		snapshot.step = interpolationStep;
+		snapshot.ids.resize(n);
+		snapshot.bodies.resize(n);
+		snapshot.previousPositions.resize(3 * n);
+		std::fill(snapshot.indices.begin(), snapshot.indices.end(), BodyStore::InvalidIndex);
+		for (size_t i = 0; i < n; ++i)
+		{
+			const BodyId id = bodies.idAt(i);
+			snapshot.ids[i] = id;
+			if (id >= snapshot.indices.size())
+				snapshot.indices.resize((size_t)id + 1, BodyStore::InvalidIndex);
+			snapshot.indices[id] = (uint32_t)i;
+			const Body body = bodies.get(i);
+			snapshot.bodies[i] = body;
+
+			// Bodies that weren't there before the step start where they are now
+			const bool moved = interpolationStep > 0 && i < m && previousIds[i] == id;
+			snapshot.previousPositions[3 * i] = moved ? previousPositions[i] : body.x;
+			snapshot.previousPositions[3 * i + 1] = moved ? previousPositions[m + i] : body.y;
+			snapshot.previousPositions[3 * i + 2] = moved ? previousPositions[2 * m + i] : body.z;
+		}
+
+		snapshot.stats = simulation.getStats();
+		snapshot.simulatedTime = simulatedTime;
+		snapshot.droppedTime = clock.GetDroppedTime();
+		snapshots.publish();
+	}
+}
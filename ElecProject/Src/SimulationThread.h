@@ -0,0 +1,129 @@
+//
+// Runs a Simulation on its own thread so a heavy physics step doesn't
+// hold up the frame and a vsync wait doesn't hold up the physics.
+// After each batch of steps the thread publishes a snapshot of every
+// body through a triple buffer, the renderer draws the newest one
+// without waiting. Changes from the UI are queued as commands that the
+// simulation thread applies in order before its next step.
+//
+
+#pragma once
+#include "Simulation.h"
+#include "TripleBuffer.h"
+#include "FixedTimestep.h"
+#include "FrameTimer.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace phys
+{
+	// State of the simulation at one moment, read only for the renderer
+	struct Snapshot
+	{
+		// Commands that were applied before this state was taken
+		uint64_t commandsApplied = 0;
+		// When the snapshot was published and the step it covers, the bodies are
+		// drawn moving from previousPositions to their positions over that step.
+		// A step of 0 means there is nothing to move between.
+		std::chrono::steady_clock::time_point time;
+		float step = 0;
+
+		std::vector<BodyId> ids;
+		std::vector<uint32_t> indices; // id -> index, BodyStore::InvalidIndex when the body isn't in it
+		std::vector<Body> bodies;
+		std::vector<float> previousPositions; // x, y, z of each body before the last step
+
+		Simulation::Stats stats;
+		float simulatedTime = 0; // Seconds the bodies have been stepped
+		float droppedTime = 0; // Seconds skipped because the steps couldn't keep up
+
+		size_t indexOf(BodyId id) const
+		{
+			return id < indices.size() ? indices[id] : BodyStore::InvalidIndex;
+		}
+	};
+
+	class SimulationThread
+	{
+	public:
+		using Command = std::function<void(Simulation&)>;
+
+	public:
+		SimulationThread();
+		~SimulationThread();
+		SimulationThread(const SimulationThread&) = delete;
+		SimulationThread& operator=(const SimulationThread&) = delete;
+
+		// Queues a change, returns its number. Once a snapshot's commandsApplied
+		// reaches it the change is visible in the snapshots.
+		uint64_t post(Command command);
+		// Queues fn(bodies, index) on body id, skipped when the body is gone by then
+		template<typename F>
+		uint64_t editBody(BodyId id, F&& fn)
+		{
+			return post([id, fn = std::forward<F>(fn)](Simulation& sim) mutable
+				{
+					BodyStore& bodies = sim.getBodies();
+					if (bodies.contains(id))
+						fn(bodies, bodies.indexOf(id));
+				});
+		}
+		// The id is handed out right away, the body appears in the snapshots once the command
+		// ran. Its number is written to command if given.
+		BodyId addBody(const Body& body, uint64_t* command = nullptr);
+		void removeBody(BodyId id);
+		void setSettings(const Simulation::Settings& settings);
+		// Where the simulated time continues from, e.g. after restoring a checkpoint
+		void setSimulatedTime(float time);
+
+		// Stepping of the simulation thread
+		void setEnabled(bool enable);
+		void setFixedTimestep(bool enable);
+		void setRate(float rate);
+		void setMaxSubsteps(int maxSubsteps);
+
+		// Newest published snapshot, doesn't block. Valid until the next call.
+		const Snapshot& latest();
+
+	private:
+		void run();
+		// Runs the steps that are due, returns whether any ran
+		bool stepDue();
+		void capturePreviousState();
+		void publish(float interpolationStep);
+
+	private:
+		Simulation simulation;
+		TripleBuffer<Snapshot> snapshots;
+
+		// Queue shared with the posting threads
+		std::mutex commandMutex;
+		std::condition_variable commandPosted;
+		std::vector<Command> pendingCommands;
+		uint64_t postedCount = 0;
+		bool stopping = false;
+
+		// Owned by the posting thread
+		BodyId nextBodyId = 0;
+
+		// Owned by the simulation thread
+		std::vector<Command> runningCommands;
+		uint64_t appliedCount = 0;
+		bool enabled = false;
+		bool fixedTimestep = true;
+		FixedTimestep clock;
+		FrameTimer timer;
+		float simulatedTime = 0;
+		// Positions before the last step (x block, y block, z block) and whose they are
+		std::vector<float> previousPositions;
+		std::vector<BodyId> previousIds;
+
+		// Started last, everything it uses exists by then
+		std::thread thread;
+	};
+}
@@ -0,0 +1,123 @@
+#include "SpatialHash.h"
+#include "ThreadPool.h"
+#include <algorithm>
+
+namespace phys
+{
+	void SpatialHash::build(const float* x, const float* y, const float* z, size_t n, float cellSize)
+	{
+		inverseCellSize = 1.f / cellSize;
+		// About two buckets per body keeps the chains short
+		size_t buckets = 16;
+		int bucketBits = 4;
+		while (buckets < 2 * n)
+		{
+			buckets *= 2;
+			++bucketBits;
+		}
+		bucketMask = buckets - 1;
+
+		// Counting sort in two passes that both split over the pool and keep the bodies of a
+		// bucket in index order on any number of threads. The first sorts the bodies by the
+		// top bits of their bucket (its group), every chunk of bodies counts and then writes
+		// its own run of each group. The second sorts each group into its buckets on its own
+		const int groupBits = std::min(bucketBits, maxGroupBits);
+		const size_t groups = (size_t)1 << groupBits;
+		const int groupShift = bucketBits - groupBits;
+		const size_t chunks = (n + chunkSize - 1) / chunkSize;
+		bucketOfBody.resize(n);
+		chunkCounts.assign(chunks * groups, 0);
+		parallelFor(chunks, 1, [&](size_t chunkBegin, size_t chunkEnd)
+			{
+				for (size_t c = chunkBegin; c < chunkEnd; ++c)
+				{
+					uint32_t* const count = chunkCounts.data() + c * groups;
+					const size_t end = std::min(n, (c + 1) * chunkSize);
+					for (size_t i = c * chunkSize; i < end; ++i)
+					{
+						const uint32_t b = bucketOf(cellCoord(x[i]), cellCoord(y[i]), cellCoord(z[i]));
+						bucketOfBody[i] = b;
+						++count[b >> groupShift];
+					}
+				}
+			});
+		// Where the run of each chunk starts, the groups in order and the chunks in order within them
+		groupStart.resize(groups + 1);
+		uint32_t total = 0;
+		for (size_t g = 0; g < groups; ++g)
+		{
+			groupStart[g] = total;
+			for (size_t c = 0; c < chunks; ++c)
+			{
+				const uint32_t count = chunkCounts[c * groups + g];
+				chunkCounts[c * groups + g] = total;
+				total += count;
+			}
+		}
+		groupStart[groups] = total;
+		byGroup.resize(n);
+		parallelFor(chunks, 1, [&](size_t chunkBegin, size_t chunkEnd)
+			{
+				for (size_t c = chunkBegin; c < chunkEnd; ++c)
+				{
+					uint32_t* const next = chunkCounts.data() + c * groups;
+					const size_t end = std::min(n, (c + 1) * chunkSize);
+					for (size_t i = c * chunkSize; i < end; ++i)
+						byGroup[next[bucketOfBody[i] >> groupShift]++] = (uint32_t)i;
+				}
+			});
+
+		// Bodies per bucket, their running sum gives the end of each bucket, then the bodies
+		// go in from the back so the start is left behind
+		bucketStart.resize(buckets + 1);
+		sorted.resize(n);
+		groupOccupied.resize(groups);
+		parallelFor(groups, groupGrain, [&](size_t groupBegin, size_t groupEnd)
+			{
+				for (size_t g = groupBegin; g < groupEnd; ++g)
+				{
+					const size_t first = g << groupShift, last = (g + 1) << groupShift;
+					std::fill(bucketStart.begin() + first, bucketStart.begin() + last, 0u);
+					for (uint32_t k = groupStart[g]; k < groupStart[g + 1]; ++k)
+						++bucketStart[bucketOfBody[byGroup[k]]];
+					uint32_t end = groupStart[g];
+					uint32_t occupiedCount = 0;
+					for (size_t b = first; b < last; ++b)
+					{
+						occupiedCount += bucketStart[b] > 0;
+						end += bucketStart[b];
+						bucketStart[b] = end;
+					}
+					groupOccupied[g] = occupiedCount;
+					for (uint32_t k = groupStart[g + 1]; k-- > groupStart[g];)
+					{
+						const uint32_t i = byGroup[k];
+						sorted[--bucketStart[bucketOfBody[i]]] = i;
+					}
+				}
+			});
+		bucketStart[buckets] = (uint32_t)n;
+
+		// Each group lists its occupied buckets from where the ones before it end
+		uint32_t occupiedTotal = 0;
+		for (size_t g = 0; g < groups; ++g)
+		{
+			const uint32_t count = groupOccupied[g];
+			groupOccupied[g] = occupiedTotal;
+			occupiedTotal += count;
+		}
+		occupied.resize(occupiedTotal);
+		parallelFor(groups, groupGrain, [&](size_t groupBegin, size_t groupEnd)
+			{
+				for (size_t g = groupBegin; g < groupEnd; ++g)
+				{
+					uint32_t next = groupOccupied[g];
+					for (size_t b = g << groupShift; b < (g + 1) << groupShift; ++b)
+					{
+						if (bucketStart[b + 1] > bucketStart[b])
+							occupied[next++] = (uint32_t)b;
+					}
+				}
+			});
+	}
+}
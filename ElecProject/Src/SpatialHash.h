@@ -0,0 +1,93 @@
+//
+// Uniform grid of cubic cells over unbounded space, stored as a hash
+// table. The bodies are sorted into the buckets with a counting sort
+// split over the thread pool, so building takes O(n) and finding the bodies near a point means
+// looking at the 27 buckets of the cells around it. Cells that hash to
+// the same bucket only add candidates, every bucket is visited once.
+//
+
+#pragma once
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace phys
+{
+	class SpatialHash
+	{
+	public:
+		// Sorts the n bodies at (x, y, z) into cells of cellSize
+		void build(const float* x, const float* y, const float* z, size_t n, float cellSize);
+
+		// Buckets that hold at least one body, in no particular order
+		const std::vector<uint32_t>& occupiedBuckets() const { return occupied; }
+
+		// Calls fn(i) for every body i in bucket b
+		template<typename F>
+		void forEachInBucket(uint32_t b, F&& fn) const
+		{
+			for (uint32_t k = bucketStart[b]; k < bucketStart[b + 1]; ++k)
+				fn(sorted[k]);
+		}
+
+		// Calls fn(i) for every body i in the cell of (px, py, pz) and the 26 cells around it
+		template<typename F>
+		void forEachNear(float px, float py, float pz, F&& fn) const
+		{
+			if (sorted.empty())
+				return;
+			const int64_t cx = cellCoord(px), cy = cellCoord(py), cz = cellCoord(pz);
+			uint32_t visited[27];
+			int visitedCount = 0;
+			for (int64_t dz = -1; dz <= 1; ++dz)
+			{
+				for (int64_t dy = -1; dy <= 1; ++dy)
+				{
+					for (int64_t dx = -1; dx <= 1; ++dx)
+					{
+						const uint32_t b = bucketOf(cx + dx, cy + dy, cz + dz);
+						bool seen = false;
+						for (int v = 0; v < visitedCount; ++v)
+							seen = seen || visited[v] == b;
+						if (seen)
+							continue;
+						visited[visitedCount++] = b;
+						forEachInBucket(b, fn);
+					}
+				}
+			}
+		}
+
+	private:
+		int64_t cellCoord(float p) const
+		{
+			return (int64_t)std::floor(p * inverseCellSize);
+		}
+
+		uint32_t bucketOf(int64_t cx, int64_t cy, int64_t cz) const
+		{
+			const uint64_t h = (uint64_t)cx * 73856093u ^ (uint64_t)cy * 19349663u ^ (uint64_t)cz * 83492791u;
+			return (uint32_t)(h & bucketMask);
+		}
+
+	private:
+		static constexpr size_t chunkSize = 16384; // bodies per task of the first pass
+		static constexpr int maxGroupBits = 10; // the first pass sorts by up to 1024 groups of buckets
+		static constexpr size_t groupGrain = 16; // groups per task of the second pass
+
+	private:
+		float inverseCellSize = 1.f;
+		uint64_t bucketMask = 0;
+		// Bodies of bucket b are sorted[bucketStart[b]..bucketStart[b + 1])
+		std::vector<uint32_t> bucketStart;
+		std::vector<uint32_t> sorted;
+		std::vector<uint32_t> bucketOfBody;
+		std::vector<uint32_t> occupied;
+		// Scratch of the sort
+		std::vector<uint32_t> chunkCounts; // bodies of each group in each chunk, then where they go
+		std::vector<uint32_t> groupStart;
+		std::vector<uint32_t> byGroup; // bodies sorted by group
+		std::vector<uint32_t> groupOccupied;
+	};
+}
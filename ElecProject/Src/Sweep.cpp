@@ -0,0 +1,279 @@
+#include "Sweep.h"
+#include "Diagnostics.h"
+#include "Simulation.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+	using namespace phys;
+	using Clock = std::chrono::steady_clock;
+
+	// Peak heap bytes per body of a run, rounded up from the most measured (fmm with rk4, about 600)
+	constexpr size_t bytesPerBody = 1024;
+	// Simulation, pools and scratch a run needs whatever its size
+	constexpr size_t bytesPerRun = 4 << 20;
+
+	bool isNameChar(char c, bool first)
+	{
+		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || (!first && c >= '0' && c <= '9');
+	}
+
+	// Length of the name at the start of text, 0 when there is none
+	size_t nameLength(std::string_view text)
+	{
+		size_t length = 0;
+		while (length < text.size() && isNameChar(text[length], length == 0))
+			++length;
+		return length;
+	}
+
+	// Text that reads back as the same float
+	std::string formatValue(double value)
+	{
+		char text[32];
+		std::snprintf(text, sizeof(text), "%.9g", value);
+		return text;
+	}
+
+	SweepResult runScenario(const Scenario& scenario, bool exactEnergy)
+	{
+		SweepResult result;
+		Simulation simulation;
+		const auto setupStart = Clock::now();
+		scenario.generate(simulation.getBodies());
+		result.setupSeconds = std::chrono::duration<double>(Clock::now() - setupStart).count();
+		result.bodies = simulation.getBodies().size();
+		result.steps = scenario.steps;
+
+		Simulation::Settings settings = scenario.settings;
+		// Only the start and the end are measured
+		settings.measureDiagnostics = false;
+		simulation.setSettings(settings);
+		// Summed over every pair unless that would take longer than the run, a sample changes
+		// with the bodies when they merge so its error is only a rough one
+		exactEnergy = exactEnergy || result.bodies <= exactEnergyBodyLimit;
+		DiagnosticsMeter meter;
+		const Diagnostics startDiagnostics = meter.measure(simulation.getBodies(), settings.G, exactEnergy);
+		const double startEnergy = startDiagnostics.totalEnergy();
+
+		const auto start = Clock::now();
+		for (long long s = 0; s < scenario.steps; ++s)
+		{
+			simulation.step(scenario.dt);
+			const Simulation::Stats& stats = simulation.getStats();
+			result.collisions += stats.collisions.contacts + stats.collisions.merged;
+		}
+		result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+		result.bodiesLeft = simulation.getBodies().size();
+		const Diagnostics& endDiagnostics = meter.measure(simulation.getBodies(), settings.G, exactEnergy);
+		const double endEnergy = endDiagnostics.totalEnergy();
+		result.energyExact = startDiagnostics.potentialExact && endDiagnostics.potentialExact;
+		result.energyError = startEnergy != 0 ? std::abs((endEnergy - startEnergy) / startEnergy) : 0.0;
+		return result;
+	}
+}
+
+namespace phys
+{
+	bool ParameterSweep::addParameter(std::string_view spec, std::string& error)
+	{
+		const size_t equals = spec.find('=');
+		Parameter parameter;
+		parameter.name = spec.substr(0, std::min(equals, spec.size()));
+		if (equals == std::string_view::npos || nameLength(parameter.name) != parameter.name.size() || parameter.name.empty())
+		{
+			error = "Expected name=values in " + std::string(spec);
+			return false;
+		}
+		for (const Parameter& p : parameters)
+		{
+			if (p.name == parameter.name)
+			{
+				error = parameter.name + " is swept twice";
+				return false;
+			}
+		}
+		const std::string values(spec.substr(equals + 1));
+
+		// first:last:count
+		double first = 0, last = 0;
+		int count = 0;
+		char end = 0;
+		if (std::sscanf(values.c_str(), "%lf:%lf:%d%c", &first, &last, &count, &end) == 3)
+		{
+			if (count < 1)
+			{
+				error = parameter.name + " needs at least one value";
+				return false;
+			}
+			for (int i = 0; i < count; ++i)
+				parameter.values.push_back(formatValue(count == 1 ? first : first + (last - first) * i / (count - 1)));
+		}
+		else
+		{
+			size_t begin = 0;
+			while (begin <= values.size())
+			{
+				const size_t comma = std::min(values.find(',', begin), values.size());
+				if (comma == begin)
+				{
+					error = parameter.name + " has an empty value";
+					return false;
+				}
+				parameter.values.push_back(values.substr(begin, comma - begin));
+				begin = comma + 1;
+			}
+		}
+		parameters.push_back(std::move(parameter));
+		return true;
+	}
+
+	size_t ParameterSweep::runCount() const
+	{
+		size_t count = 1;
+		for (const Parameter& p : parameters)
+			count *= p.values.size();
+		return count;
+	}
+
+	std::vector<std::string> ParameterSweep::valuesOf(size_t run) const
+	{
+		std::vector<std::string> values(parameters.size());
+		for (size_t k = parameters.size(); k-- > 0;)
+		{
+			const std::vector<std::string>& choices = parameters[k].values;
+			values[k] = choices[run % choices.size()];
+			run /= choices.size();
+		}
+		return values;
+	}
+
+	std::string ParameterSweep::expand(std::string_view text, size_t run) const
+	{
+		const std::vector<std::string> values = valuesOf(run);
+		std::string expanded;
+		expanded.reserve(text.size());
+		size_t pos = 0;
+		while (pos < text.size())
+		{
+			const size_t dollar = std::min(text.find('$', pos), text.size());
+			expanded.append(text.substr(pos, dollar - pos));
+			if (dollar == text.size())
+				break;
+			const std::string_view name = text.substr(dollar + 1, nameLength(text.substr(dollar + 1)));
+			const auto p = std::find_if(parameters.begin(), parameters.end(), [&](const Parameter& p) { return p.name == name; });
+			// Anything that isn't a parameter is left for the scenario to complain about
+			if (p != parameters.end())
+				expanded += values[p - parameters.begin()];
+			else
+				expanded.append(text.substr(dollar, name.size() + 1));
+			pos = dollar + 1 + name.size();
+		}
+		return expanded;
+	}
+
+	bool ParameterSweep::makeScenarios(std::string_view text, std::vector<Scenario>& scenarios, std::string& error) const
+	{
+		for (const Parameter& p : parameters)
+		{
+			const std::string placeholder = "$" + p.name;
+			size_t at = text.find(placeholder);
+			while (at != std::string_view::npos && nameLength(text.substr(at + placeholder.size())) > 0)
+				at = text.find(placeholder, at + 1);
+			if (at == std::string_view::npos)
+			{
+				error = "The scenario doesn't use $" + p.name;
+				return false;
+			}
+		}
+		const size_t runs = runCount();
+		scenarios.assign(runs, Scenario());
+		for (size_t run = 0; run < runs; ++run)
+		{
+			if (!scenarios[run].parse(expand(text, run), error))
+			{
+				error = "Run " + std::to_string(run) + ": " + error;
+				return false;
+			}
+		}
+		return true;
+	}
+
+	size_t estimateRunMemory(size_t bodyCount)
+	{
+		return bytesPerRun + bodyCount * bytesPerBody;
+	}
+
+	void runSweep(const std::vector<Scenario>& scenarios, const SweepOptions& options,
+		const std::function<void(const SweepResult&)>& done)
+	{
+		const size_t threadsPerRun = std::max<size_t>(1, options.threadsPerRun);
+		size_t jobs = options.jobs;
+		if (jobs == 0)
+			jobs = std::max<size_t>(1, std::thread::hardware_concurrency() / threadsPerRun);
+		jobs = std::min(jobs, scenarios.size());
+
+		std::mutex mutex;
+		std::condition_variable memoryFreed;
+		size_t next = 0;
+		size_t running = 0;
+		size_t memoryInUse = 0;
+		std::mutex doneMutex;
+
+		auto runner = [&]()
+			{
+				// The run's loops split over this pool only, so the runs don't queue on each other's tasks
+				ThreadPool pool(threadsPerRun - 1);
+				ThreadPool::setForThisThread(&pool);
+				for (;;)
+				{
+					size_t run = 0;
+					size_t memory = 0;
+					{
+						// The runs start in order, a big one holds back the ones after it until there is room
+						std::unique_lock<std::mutex> lock(mutex);
+						memoryFreed.wait(lock, [&]()
+							{
+								return next == scenarios.size() || running == 0 || options.memoryBudget == 0 ||
+									memoryInUse + estimateRunMemory(scenarios[next].bodyCount()) <= options.memoryBudget;
+							});
+						if (next == scenarios.size())
+							break;
+						run = next++;
+						memory = estimateRunMemory(scenarios[run].bodyCount());
+						memoryInUse += memory;
+						++running;
+					}
+					// The next run may be a smaller one that fits
+					memoryFreed.notify_all();
+
+					SweepResult result = runScenario(scenarios[run], options.exactEnergy);
+					result.run = run;
+					{
+						std::lock_guard<std::mutex> lock(mutex);
+						memoryInUse -= memory;
+						--running;
+					}
+					memoryFreed.notify_all();
+					std::lock_guard<std::mutex> lock(doneMutex);
+					done(result);
+				}
+				ThreadPool::setForThisThread(nullptr);
+			};
+
+		std::vector<std::thread> threads;
+		for (size_t j = 1; j < jobs; ++j)
+			threads.emplace_back(runner);
+		runner();
+		for (std::thread& t : threads)
+			t.join();
+	}
+}
@@ -0,0 +1,85 @@
+//
+// Runs one scenario over a grid of parameter values, every combination
+// as an independent simulation. The scenario text marks the swept values
+// with $name placeholders:
+//
+//   G $G
+//   grid count=20,20,20 spacing=$spacing mass=$mass bodyRadius=2
+//
+// and each parameter gets a list of values (G=0.5,1,2) or an evenly
+// spaced range (spacing=5:20:4 is 5, 10, 15, 20). The runs don't share
+// anything, so rather than splitting each of them over all the cores
+// several run at once on a small pool of their own. How many run at once
+// is bounded by the job count and by a memory budget that is checked
+// against an estimate of each run's memory, so a grid of thousands of
+// runs never holds more than a few body stores.
+//
+
+#pragma once
+#include "Scenario.h"
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace phys
+{
+	class ParameterSweep
+	{
+	public:
+		struct Parameter
+		{
+			std::string name;
+			std::vector<std::string> values; // substituted as they are written
+		};
+
+	public:
+		// Adds "name=v1,v2,..." or "name=first:last:count", returns false with the reason in error
+		bool addParameter(std::string_view spec, std::string& error);
+		const std::vector<Parameter>& getParameters() const { return parameters; }
+		// Combinations of the values, 1 without parameters
+		size_t runCount() const;
+		// Value of each parameter in the run, the last parameter changes fastest
+		std::vector<std::string> valuesOf(size_t run) const;
+		// Text with every $name of a parameter replaced by its value in the run
+		std::string expand(std::string_view text, size_t run) const;
+		// Reads the scenario of every run, returns false with the run and the reason in error
+		// when a parameter isn't used by the text or one of the runs can't be read
+		bool makeScenarios(std::string_view text, std::vector<Scenario>& scenarios, std::string& error) const;
+
+	private:
+		std::vector<Parameter> parameters;
+	};
+
+	// Outcome of one run of a sweep
+	struct SweepResult
+	{
+		size_t run = 0;
+		size_t bodies = 0; // at the start
+		size_t bodiesLeft = 0;
+		long long steps = 0;
+		double energyError = 0; // relative change of the total energy from the start to the end
+		bool energyExact = true; // false when energyError is of a sampled potential
+		size_t collisions = 0; // contacts and merges over all the steps
+		double setupSeconds = 0; // generating the bodies
+		double seconds = 0; // stepping
+	};
+
+	struct SweepOptions
+	{
+		size_t jobs = 0; // runs at once, 0 for as many as the cores allow
+		size_t threadsPerRun = 1;
+		size_t memoryBudget = 0; // bytes for all the running runs together, 0 for no limit
+		bool exactEnergy = false; // every pair for the energy error past exactEnergyBodyLimit bodies too
+	};
+
+	// Rough peak heap use of a run with bodyCount bodies, bodies, solver and scratch together
+	size_t estimateRunMemory(size_t bodyCount);
+
+	// Runs every scenario and hands each result to done as the run finishes, one call at
+	// a time but in the order the runs finish. A run bigger than the memory budget on its
+	// own still runs, with nothing else beside it.
+	void runSweep(const std::vector<Scenario>& scenarios, const SweepOptions& options,
+		const std::function<void(const SweepResult&)>& done);
+}
@@ -0,0 +1,143 @@
+// Runs a scenario over a grid of parameter values without a window, every
+// combination as its own simulation, several at once, and writes one
+// summary line per run: the parameter values, the energy error and
+// whether it is exact, the collisions and the time it took. Built by CMakeLists.txt, not by the
+// Visual Studio project.
+
+#include "Scenario.h"
+#include "Sweep.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+	struct Options
+	{
+		std::string input;
+		std::string output = "sweep.csv";
+		phys::ParameterSweep sweep;
+		phys::SweepOptions run;
+	};
+
+	void printUsage()
+	{
+		std::puts(
+			"Usage: ElecSweep <scenario> --param NAME=VALUES [--param ...] [options]\n"
+			"  --param NAME=A,B,C    values for $NAME in the scenario\n"
+			"  --param NAME=A:B:N    N evenly spaced values from A to B\n"
+			"  --out FILE            summary csv, one line per run (sweep.csv)\n"
+			"  --jobs N              runs at once (hardware threads / threads per run)\n"
+			"  --threads-per-run N   threads each run splits its steps over (1)\n"
+			"  --memory MB           memory for all the running runs together (no limit)\n"
+			"  --exact-energy        sum every pair for the energy error, past 10000 bodies too");
+	}
+
+	// Returns false with a message on stderr when the arguments don't make sense
+	bool parseOptions(int argc, char** argv, Options& options)
+	{
+		if (argc < 2 || argv[1][0] == '-')
+			return false;
+		options.input = argv[1];
+		for (int a = 2; a < argc; ++a)
+		{
+			const std::string name = argv[a];
+			if (name == "--exact-energy")
+			{
+				options.run.exactEnergy = true;
+				continue;
+			}
+			if (a + 1 >= argc)
+			{
+				std::fprintf(stderr, "%s needs a value\n", name.c_str());
+				return false;
+			}
+			const char* value = argv[++a];
+			std::string error;
+			if (name == "--param")
+			{
+				if (!options.sweep.addParameter(value, error))
+				{
+					std::fprintf(stderr, "%s\n", error.c_str());
+					return false;
+				}
+			}
+			else if (name == "--out")
+				options.output = value;
+			else if (name == "--jobs")
+				options.run.jobs = (size_t)std::max(1, std::atoi(value));
+			else if (name == "--threads-per-run")
+				options.run.threadsPerRun = (size_t)std::max(1, std::atoi(value));
+			else if (name == "--memory")
+				options.run.memoryBudget = (size_t)std::max(1.0, std::atof(value)) << 20;
+			else
+			{
+				std::fprintf(stderr, "Unknown option %s %s\n", name.c_str(), value);
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	if (!parseOptions(argc, argv, options))
+	{
+		printUsage();
+		return 1;
+	}
+
+	std::ifstream input(options.input);
+	if (!input)
+	{
+		std::fprintf(stderr, "Can't open %s\n", options.input.c_str());
+		return 1;
+	}
+	std::stringstream text;
+	text << input.rdbuf();
+	std::vector<phys::Scenario> scenarios;
+	std::string error;
+	if (!options.sweep.makeScenarios(text.str(), scenarios, error))
+	{
+		std::fprintf(stderr, "%s\n", error.c_str());
+		return 1;
+	}
+
+	std::ofstream summary(options.output, std::ios::trunc);
+	if (!summary)
+	{
+		std::fprintf(stderr, "Can't open %s for writing\n", options.output.c_str());
+		return 1;
+	}
+	summary << "run";
+	for (const phys::ParameterSweep::Parameter& p : options.sweep.getParameters())
+		summary << ',' << p.name;
+	summary << ",bodies,bodiesLeft,steps,energyError,energyExact,collisions,setupSeconds,seconds\n";
+
+	std::printf("%zu runs\n", scenarios.size());
+	const auto start = std::chrono::steady_clock::now();
+	size_t finished = 0;
+	phys::runSweep(scenarios, options.run, [&](const phys::SweepResult& r)
+		{
+			summary << r.run;
+			for (const std::string& value : options.sweep.valuesOf(r.run))
+				summary << ',' << value;
+			char line[256];
+			std::snprintf(line, sizeof(line), ",%zu,%zu,%lld,%.6e,%d,%zu,%.4f,%.4f\n",
+				r.bodies, r.bodiesLeft, r.steps, r.energyError, (int)r.energyExact, r.collisions, r.setupSeconds, r.seconds);
+			// Flushed every line so the finished runs are there even if the sweep is stopped
+			summary << line << std::flush;
+			std::printf("[%zu/%zu] run %zu: energy error %.3e%s, %zu collisions, %.3f s\n",
+				++finished, scenarios.size(), r.run, r.energyError, r.energyExact ? "" : " (estimated)", r.collisions, r.seconds);
+		});
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::printf("%.3f s, summary in %s\n", seconds, options.output.c_str());
+	return summary ? 0 : 1;
+}
@@ -0,0 +1,192 @@
+#include "ThreadPool.h"
+#include "AllocationCounter.h"
+#include <algorithm>
+#include <cstdint>
+
+namespace
+{
+	// Which pool and deque the current thread belongs to
+	thread_local const phys::ThreadPool* currentPool = nullptr;
+	thread_local size_t currentIndex = 0;
+	// Allocations of this worker already added to its pool's count
+	thread_local size_t reportedAllocations = 0;
+	// Pool get() returns on this thread instead of the shared one
+	thread_local phys::ThreadPool* threadPool = nullptr;
+
+	// Cheap per thread random numbers to pick a victim to steal from
+	uint32_t nextRandom()
+	{
+		thread_local uint32_t state = 0x9E3779B9u ^ (uint32_t)(uintptr_t)&state;
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+}
+
+namespace phys
+{
+	ThreadPool& ThreadPool::get()
+	{
+		if (threadPool)
+			return *threadPool;
+		static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+		return pool;
+	}
+
+	void ThreadPool::setForThisThread(ThreadPool* pool)
+	{
+		threadPool = pool;
+	}
+
+	ThreadPool::ThreadPool(size_t workerCount)
+	{
+		deques.reserve(workerCount + 1);
+		for (size_t i = 0; i < workerCount + 1; ++i)
+			deques.push_back(std::make_unique<WorkDeque>());
+		workers.reserve(workerCount);
+		for (size_t i = 0; i < workerCount; ++i)
+			workers.emplace_back([this, i]() { workerLoop(i + 1); });
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto& w : workers)
+			w.join();
+	}
+
+	bool ThreadPool::WorkDeque::pushBack(const Task& task)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (count == Capacity)
+			return false;
+		tasks[(head + count++) % Capacity] = task;
+		return true;
+	}
+
+	bool ThreadPool::WorkDeque::popBack(Task& task)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (count == 0)
+			return false;
+		task = tasks[(head + --count) % Capacity];
+		return true;
+	}
+
+	bool ThreadPool::WorkDeque::stealFront(Task& task)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (count == 0)
+			return false;
+		task = tasks[head];
+		head = (head + 1) % Capacity;
+		--count;
+		return true;
+	}
+
+	size_t ThreadPool::selfIndex() const
+	{
+		return currentPool == this ? currentIndex : 0;
+	}
+
+	void ThreadPool::run(Job& job, size_t count)
+	{
+		const size_t self = selfIndex();
+		execute(self, { &job, 0, count });
+		// Help with whatever is queued (this job or others) until the job is done
+		while (job.remaining.load(std::memory_order_acquire) > 0)
+		{
+			if (!tryRunOne(self))
+				std::this_thread::yield();
+		}
+	}
+
+	void ThreadPool::workerLoop(size_t self)
+	{
+		currentPool = this;
+		currentIndex = self;
+		reportedAllocations = threadAllocationCount();
+		for (;;)
+		{
+			// Spin a little before going to sleep, loops usually come in bursts
+			bool ran = false;
+			for (int spin = 0; spin < 64 && !ran; ++spin)
+			{
+				ran = tryRunOne(self);
+				if (!ran)
+					std::this_thread::yield();
+			}
+			if (ran)
+				continue;
+
+			std::unique_lock<std::mutex> lock(sleepMutex);
+			sleepers.fetch_add(1);
+			wake.wait(lock, [this]() { return stopping || queuedTasks.load() > 0; });
+			sleepers.fetch_sub(1);
+			if (stopping)
+				return;
+		}
+	}
+
+	bool ThreadPool::tryRunOne(size_t self)
+	{
+		Task task;
+		bool found = deques[self]->popBack(task);
+		for (size_t k = 0, start = nextRandom(); !found && k < deques.size(); ++k)
+		{
+			const size_t victim = (start + k) % deques.size();
+			if (victim != self)
+				found = deques[victim]->stealFront(task);
+		}
+		if (!found)
+			return false;
+		queuedTasks.fetch_sub(1);
+		execute(self, task);
+		return true;
+	}
+
+	void ThreadPool::execute(size_t self, Task task)
+	{
+		Job& job = *task.job;
+		while (task.end - task.begin > job.grain)
+		{
+			const size_t mid = task.begin + (task.end - task.begin) / 2;
+			push(self, { &job, mid, task.end });
+			task.end = mid;
+		}
+		job.run(job.ctx, task.begin, task.end);
+		// Counted before the job is done so the caller sees them once parallelFor returns
+		if (currentPool == this)
+		{
+			const size_t allocations = threadAllocationCount();
+			if (allocations != reportedAllocations)
+			{
+				workerAllocations.fetch_add(allocations - reportedAllocations, std::memory_order_release);
+				reportedAllocations = allocations;
+			}
+		}
+		// Last access to the job, the caller may return as soon as it reaches 0
+		job.remaining.fetch_sub(task.end - task.begin, std::memory_order_acq_rel);
+	}
+
+	void ThreadPool::push(size_t self, const Task& task)
+	{
+		if (!deques[self]->pushBack(task))
+		{
+			// Deque is full, just do it now
+			execute(self, task);
+			return;
+		}
+		queuedTasks.fetch_add(1);
+		if (sleepers.load() > 0)
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			wake.notify_one();
+		}
+	}
+}
@@ -0,0 +1,126 @@
+//
+// Work-stealing thread pool for the data parallel loops of the physics.
+// Every thread has its own deque of ranges. A thread takes work from the
+// back of its own deque and splits big ranges in half, pushing the upper
+// half back, so the halves left at the front are the biggest ones and
+// that is where idle threads steal from. The thread that calls
+// parallelFor works on the loop as well until it is done.
+//
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace phys
+{
+	class ThreadPool
+	{
+	public:
+		// Pool shared by the whole program, one worker per hardware thread besides the caller,
+		// unless the calling thread picked another one with setForThisThread
+		static ThreadPool& get();
+		// Makes get() return pool on the calling thread, null goes back to the shared one.
+		// Lets independent simulations run side by side with a pool each.
+		static void setForThisThread(ThreadPool* pool);
+
+		explicit ThreadPool(size_t workerCount);
+		~ThreadPool();
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		// Workers plus the calling thread
+		size_t threadCount() const { return workers.size() + 1; }
+		// Heap allocations the workers made in tasks since the pool started, whichever
+		// thread the loops came from. The threads that call parallelFor count their own.
+		size_t workerAllocationCount() const { return workerAllocations.load(std::memory_order_acquire); }
+
+		// Calls fn(begin, end) on disjoint ranges covering [0, count), each at most
+		// grain long, and returns when all of them have run. Doesn't allocate.
+		template<typename F>
+		void parallelFor(size_t count, size_t grain, F&& fn)
+		{
+			if (count == 0)
+				return;
+			grain = grain > 0 ? grain : 1;
+			if (workers.empty() || count <= grain)
+			{
+				fn(size_t(0), count);
+				return;
+			}
+
+			Job job;
+			job.run = [](void* ctx, size_t begin, size_t end)
+				{
+					(*static_cast<std::remove_reference_t<F>*>(ctx))(begin, end);
+				};
+			job.ctx = const_cast<void*>(static_cast<const void*>(&fn));
+			job.grain = grain;
+			job.remaining.store(count, std::memory_order_relaxed);
+			run(job, count);
+		}
+
+	private:
+		struct Job
+		{
+			void (*run)(void* ctx, size_t begin, size_t end);
+			void* ctx;
+			size_t grain;
+			std::atomic<size_t> remaining; // items that haven't run yet
+		};
+
+		struct Task
+		{
+			Job* job;
+			size_t begin;
+			size_t end;
+		};
+
+		// Fixed size ring of tasks, the owner works at the back and thieves at the front
+		class WorkDeque
+		{
+		public:
+			static constexpr size_t Capacity = 1024;
+			bool pushBack(const Task& task);
+			bool popBack(Task& task);
+			bool stealFront(Task& task);
+		private:
+			std::mutex mutex;
+			Task tasks[Capacity];
+			size_t head = 0; // first task
+			size_t count = 0;
+		};
+
+		void run(Job& job, size_t count);
+		void workerLoop(size_t self);
+		// Runs one task from the own deque or stolen from another one
+		bool tryRunOne(size_t self);
+		// Runs a task, keeps splitting it while it is bigger than the grain
+		void execute(size_t self, Task task);
+		void push(size_t self, const Task& task);
+		size_t selfIndex() const;
+
+	private:
+		// deques[0] is shared by every thread that isn't a worker, worker i owns deques[i + 1]
+		std::vector<std::unique_ptr<WorkDeque>> deques;
+		std::vector<std::thread> workers;
+		std::atomic<size_t> queuedTasks = 0;
+		std::atomic<size_t> sleepers = 0;
+		std::atomic<size_t> workerAllocations = 0;
+		std::mutex sleepMutex;
+		std::condition_variable wake;
+		bool stopping = false;
+	};
+
+	// parallelFor on the shared pool
+	template<typename F>
+	void parallelFor(size_t count, size_t grain, F&& fn)
+	{
+		ThreadPool::get().parallelFor(count, grain, std::forward<F>(fn));
+	}
+}
@@ -0,0 +1,49 @@
+//
+// Lock-free triple buffer for handing whole states from one writer thread
+// to one reader thread. The writer fills the back slot and publishes it,
+// the reader takes the newest published slot. Neither side ever waits for
+// the other, the reader skips the states it was too slow to look at.
+//
+
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+namespace phys
+{
+	template<typename T>
+	class TripleBuffer
+	{
+	public:
+		// Writer: slot to fill, it holds whatever was published some time ago
+		T& back()
+		{
+			return slots[backIndex];
+		}
+
+		// Writer: makes the back slot the newest state and takes a free slot as the new back
+		void publish()
+		{
+			backIndex = middle.exchange(backIndex | freshBit, std::memory_order_acq_rel) & indexMask;
+		}
+
+		// Reader: newest published state, stays untouched by the writer until the next call
+		const T& acquire()
+		{
+			if (middle.load(std::memory_order_relaxed) & freshBit)
+				frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & indexMask;
+			return slots[frontIndex];
+		}
+
+	private:
+		static constexpr uint8_t indexMask = 3;
+		static constexpr uint8_t freshBit = 4; // the middle slot was published after the reader last took one
+
+	private:
+		T slots[3];
+		// Slot between the two threads, swapped with the back slot by the writer and with the front slot by the reader
+		std::atomic<uint8_t> middle = 1;
+		uint8_t backIndex = 0; // writer only
+		uint8_t frontIndex = 2; // reader only
+	};
+}
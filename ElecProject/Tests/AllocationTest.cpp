@@ -0,0 +1,72 @@
+// A physics step in the steady state must not touch the heap, with any
+// of the gravity solvers. Counts every thread, the pool's workers too.
+
+#include "AllocationCounter.h"
+#include "Check.h"
+#include "Scenario.h"
+#include "Simulation.h"
+#include "ThreadPool.h"
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+int main()
+{
+	using phys::Simulation;
+	// Workers of their own, so the tasks run on other threads even on a single core
+	phys::ThreadPool pool(3);
+	phys::ThreadPool::setForThisThread(&pool);
+	phys::Scenario scenario;
+	std::string error;
+	CHECK(scenario.parse("sphere count=5000 radius=400 mass=1e-3 bodyRadius=0.5 speed=1", error));
+
+	struct Case
+	{
+		const char* name;
+		Simulation::GravitySolver solver;
+		bool pairwise;
+	};
+	const Case cases[] = {
+		{ "direct", Simulation::GravitySolver::Direct, false },
+		{ "pairwise", Simulation::GravitySolver::Direct, true },
+		{ "barnes-hut", Simulation::GravitySolver::BarnesHut, false },
+		{ "fmm", Simulation::GravitySolver::Fmm, false },
+	};
+	for (const Case& c : cases)
+	{
+		Simulation simulation;
+		scenario.generate(simulation.getBodies());
+		Simulation::Settings settings = scenario.settings;
+		settings.gravitySolver = c.solver;
+		settings.gravityPairwise = c.pairwise;
+		simulation.setSettings(settings);
+		// The first steps size the scratch memory, the step's own count has to see all of it
+		for (int s = 0; s < 3; ++s)
+		{
+			phys::AllocationScope warmUp;
+			simulation.step(1.f / 120.f);
+			CHECK(simulation.getStats().allocations == warmUp.allocations());
+		}
+
+		phys::AllocationScope scope;
+		for (int s = 0; s < 5; ++s)
+			simulation.step(1.f / 120.f);
+		std::printf("%s: %zu allocations in 5 steps\n", c.name, scope.allocations());
+		CHECK(scope.allocations() == 0);
+	}
+
+	// Allocations in tasks count for the pool when a worker runs them, the caller counts its own
+	std::vector<std::unique_ptr<int>> boxes(4096);
+	phys::AllocationScope all;
+	phys::ThreadAllocationScope caller;
+	const size_t workerStart = pool.workerAllocationCount();
+	pool.parallelFor(boxes.size(), 1, [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; ++i)
+				boxes[i] = std::make_unique<int>((int)i);
+		});
+	CHECK(all.allocations() == boxes.size());
+	CHECK(caller.allocations() + (pool.workerAllocationCount() - workerStart) == boxes.size());
+	return test::failures == 0 ? 0 : 1;
+}
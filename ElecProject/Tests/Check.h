@@ -0,0 +1,22 @@
+//
+// Minimal checks for the headless tests. A failed CHECK prints the
+// expression and its line and makes the test exit with 1.
+//
+
+#pragma once
+#include <cstdio>
+
+namespace test
+{
+	inline int failures = 0;
+}
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+			++test::failures; \
+		} \
+	} while (false)
@@ -0,0 +1,17 @@
+# Runs a scenario on 1 and on THREADS threads and fails unless the final
+# checkpoints are the same byte for byte.
+#   cmake -DHEADLESS=... -DSCENARIO=... -DTHREADS=4 -DOUT=dir -P CompareThreads.cmake
+foreach(threads 1 ${THREADS})
+	execute_process(
+		COMMAND ${HEADLESS} ${SCENARIO} --threads ${threads} --out ${OUT}/threads${threads}.bin
+		RESULT_VARIABLE result)
+	if(NOT result EQUAL 0)
+		message(FATAL_ERROR "ElecHeadless on ${threads} threads failed: ${result}")
+	endif()
+endforeach()
+execute_process(
+	COMMAND ${CMAKE_COMMAND} -E compare_files ${OUT}/threads1.bin ${OUT}/threads${THREADS}.bin
+	RESULT_VARIABLE different)
+if(different)
+	message(FATAL_ERROR "The checkpoints on 1 and ${THREADS} threads differ")
+endif()
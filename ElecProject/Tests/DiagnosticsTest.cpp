@@ -0,0 +1,43 @@
+// The sampled potential energy against the exact one, for equal masses
+// and for a disk whose central body holds nearly all of the mass.
+
+#include "Check.h"
+#include "Diagnostics.h"
+#include "Scenario.h"
+#include <cmath>
+#include <cstdio>
+#include <string>
+
+int main()
+{
+	const char* const generators[] = {
+		"sphere count=%zu radius=100 mass=1e-3 bodyRadius=0.5 speed=1",
+		"disk count=%zu inner=20 outer=100 thickness=2 mass=1e-4 bodyRadius=0.5 central=100"
+	};
+	for (const char* generator : generators)
+	{
+		for (size_t n : { 60, 100, 200 })
+		{
+			char text[256];
+			std::snprintf(text, sizeof(text), generator, n);
+			phys::Scenario scenario;
+			std::string error;
+			CHECK(scenario.parse(text, error));
+			phys::BodyStore bodies;
+			scenario.generate(bodies);
+
+			phys::DiagnosticsMeter meter;
+			const phys::Diagnostics sampled = meter.measure(bodies, 1.f);
+			const phys::Diagnostics exact = meter.measure(bodies, 1.f, true);
+			CHECK(exact.potentialExact);
+			CHECK(exact.potentialSamples == bodies.size());
+			// Small systems are summed exactly, anything over the minimum sample is not
+			CHECK(sampled.potentialExact == (sampled.potentialSamples == bodies.size()));
+			CHECK(sampled.potentialExact == (bodies.size() <= 64));
+			CHECK(std::abs(sampled.potentialEnergy - exact.potentialEnergy) <= 0.05 * std::abs(exact.potentialEnergy));
+			std::printf("%zu bodies: sampled %.6e from %zu, exact %.6e\n",
+				bodies.size(), sampled.potentialEnergy, sampled.potentialSamples, exact.potentialEnergy);
+		}
+	}
+	return test::failures == 0 ? 0 : 1;
+}
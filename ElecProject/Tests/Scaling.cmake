@@ -0,0 +1,39 @@
+# Steps per second of the direct and the pairwise sum on 1, 2, 4, ... threads
+# up to every hardware thread, and the speedup over a single thread.
+#   cmake -DHEADLESS=... -DSCENARIO=... [-DMAX_THREADS=N] -P Scaling.cmake
+if(NOT MAX_THREADS)
+	cmake_host_system_information(RESULT MAX_THREADS QUERY NUMBER_OF_LOGICAL_CORES)
+endif()
+set(counts)
+set(threads 1)
+while(threads LESS MAX_THREADS)
+	list(APPEND counts ${threads})
+	math(EXPR threads "${threads} * 2")
+endwhile()
+list(APPEND counts ${MAX_THREADS})
+
+foreach(solver direct pairwise)
+	foreach(threads ${counts})
+		execute_process(
+			COMMAND ${HEADLESS} ${SCENARIO} --solver ${solver} --threads ${threads}
+			OUTPUT_VARIABLE output
+			RESULT_VARIABLE result)
+		if(NOT result EQUAL 0 OR NOT output MATCHES "([0-9.]+) steps/s")
+			message(FATAL_ERROR "ElecHeadless --solver ${solver} --threads ${threads} failed")
+		endif()
+		set(rate ${CMAKE_MATCH_1})
+		# The rate has one decimal, integer math in tenths
+		string(REPLACE "." "" tenths ${rate})
+		if(threads EQUAL 1)
+			set(single ${tenths})
+		endif()
+		math(EXPR speedup "${tenths} * 100 / ${single}")
+		math(EXPR efficiency "${speedup} / ${threads}")
+		math(EXPR whole "${speedup} / 100")
+		math(EXPR fraction "${speedup} % 100")
+		if(fraction LESS 10)
+			set(fraction "0${fraction}")
+		endif()
+		message("${solver} on ${threads} threads: ${rate} steps/s, ${whole}.${fraction}x, ${efficiency}% efficiency")
+	endforeach()
+endforeach()